@@ -0,0 +1,430 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <string.h>
+#include <stdbool.h>
+
+// =====================================
+// Wire Format: What the client and server have to agree on byte for byte is
+// kept here, once for both of them: the trailer's extension bits, the SYN
+// options and the code that writes and reads them, and SHA-256.
+
+#define EXT_TS 0x1       /* trailer carries timestamps */
+#define EXT_ECN 0x2      /* data is sent ECT and CE marks are echoed */
+#define EXT_SR 0x4       /* pkts marked EXT_SEL are acked selectively */
+#define EXT_FEC 0x8      /* the client sends parity pkts and the server counts what it receives */
+#define EXT_FTN 0x10     /* the file after the first pkt goes out as fountain-coded symbols */
+#define EXT_NAK 0x20     /* the server reports gaps with NAKs and thins out its (cumulative) ACKs */
+#define EXT_PULL 0x40    /* new pkts past the first PULL_UNSCHED wait for credit from the server */
+#define EXT_MSS 0x80     /* data pkts carry segments of the agreed mss, which may exceed PAYLOAD_SIZE */
+#define EXT_CE 0x100     /* signal, not negotiated: the pkt being answered arrived CE-marked */
+#define EXT_SEL 0x200    /* signal, not negotiated: this pkt (or the one being answered) is under SR */
+#define EXT_PAR 0x400    /* signal, not negotiated: this pkt is parity over the group its seqnum and acknum name */
+#define EXT_SYM 0x800    /* signal, not negotiated: this pkt is a fountain symbol, its id in seqnum and acknum */
+#define EXT_NAKD 0x1000  /* signal, not negotiated: this pkt is a NAK for the gap of data starting at its acknum */
+#define EXT_GNT 0x2000   /* signal, not negotiated: this pkt only carries credit */
+#define OPT_PAD 0        /* SYN option: pads out the rest of the payload */
+#define OPT_FEATURES 1   /* SYN option, 4 bytes: the EXT_* bits below EXT_CE offered or agreed, but EXT_SR and EXT_NAK */
+#define OPT_ACK 2        /* SYN option, 1 byte: ACK_MARKED or ACK_NAK */
+#define OPT_WND 3        /* SYN option, 2 bytes: window in pkts */
+#define OPT_MSS 4        /* SYN option, 2 bytes: segment size, which the SYN is padded to */
+#define OPT_SEQ 5        /* SYN option, 4 bytes: seqnums in the seq space */
+#define OPT_TICKET 6     /* SYN option, 0 bytes to ask for a resumption ticket or TICKET_SIZE to redeem one; SYN-ACK: a new one */
+#define OPT_EARLY 7      /* SYN option, 2 bytes: file data at the end of the SYN payload, sent on a redeemed ticket */
+#define OPT_SESSION 8    /* SYN option, 0 bytes: the stream is a session of files, each behind a header */
+#define OPT_MUX 9        /* SYN option, 0 bytes: the session's streams are interleaved in frames */
+#define OPT_STRIPE 10    /* SYN option, STRIPE_SIZE bytes: this connection carries one range of a striped file; SYN-ACK: 0 bytes */
+#define STRIPE_SIZE 22   /* OPT_STRIPE: transfer id (4 bytes), stripes (2), the range's offset (8) and the file's size (8) */
+#define OPT_RESUME 11    /* SYN option, RESUME_SIZE bytes: the id of a resumable transfer; SYN-ACK: the offset to resume from */
+#define RESUME_SIZE 8
+#define OPT_HASH 12      /* SYN option, HASH_SIZE bytes: the file's SHA-256 and size; SYN-ACK, 1 byte: 1 if it is stored */
+#define DIGEST_SIZE 32
+#define HASH_SIZE 40
+#define OPT_DELTA 13     /* SYN option, DELTA_SIZE bytes: the id the file is kept under (8) and its size (8); SYN-ACK, */
+#define DELTA_SIZE 16    /* DELTA_ANSWER bytes: the block size of the signature (4), the base's size (8) and its blocks (2) */
+#define DELTA_ANSWER 14
+#define OPT_SIG 14       /* SYN-ACK option: the first block's index (2 bytes) and up to SIG_PER_OPT blocks' sums */
+#define SIG_PER_OPT 20
+#define STRONG_SIZE 8    /* bytes of a block's SHA-256 in the signature, after its 4-byte rolling sum */
+#define SIG_MAX 100      /* blocks a SYN-ACK of MSS_MAX has room for */
+#define TICKET_SIZE 16   /* resumption ticket: issue time, serial and MAC */
+#define ACK_MARKED 1     /* ACK mode: each pkt says whether it is acked selectively (EXT_SR) */
+#define ACK_NAK 2        /* ACK mode: as ACK_MARKED, plus NAKs and thinned cumulative ACKs (EXT_SR | EXT_NAK) */
+
+// =====================================
+// Capability Options: The SYN and SYN-ACK carry in their payload what the
+// spec leaves empty, a list of options, each a type byte, a length byte and
+// that many bytes of value, most significant first. The client offers the
+// features it wants (the trailer bits), an ACK mode, and any window, segment
+// or seq space other than the defaults; the server answers with what it
+// agrees to. Options a side does not know are skipped, and one not answered
+// is not agreed on, so a server that sends no options (the spec's) leaves
+// WND_SIZE, PAYLOAD_SIZE, MAX_SEQN and no extensions. The handshake itself
+// still counts its seqnums modulo MAX_SEQN, as it has to before anything is
+// agreed on.
+
+struct synOpts
+{
+    unsigned int features; /* EXT_* bits below EXT_CE, EXT_SR and EXT_NAK standing for the ACK mode */
+    int wnd;               /* window in pkts, 0 for WND_SIZE */
+    int mss;               /* segment size, 0 for PAYLOAD_SIZE */
+    int seqSpace;          /* seqnums in the seq space, 0 for MAX_SEQN */
+    int ticketLen;         /* -1 without OPT_TICKET, else 0 or TICKET_SIZE */
+    unsigned char ticket[TICKET_SIZE];
+    int early;             /* bytes of file data ending the SYN payload */
+    bool session;          /* OPT_SESSION */
+    bool mux;              /* OPT_MUX */
+    int stripeLen;         /* -1 without OPT_STRIPE, else 0 or STRIPE_SIZE */
+    unsigned int stripeId; /* the striped transfer the connection is part of */
+    int stripes;           /* connections it goes over */
+    long long stripeAt;    /* where the connection's range starts in the file */
+    long long stripeSize;  /* the whole file's size */
+    int resumeLen;         /* -1 without OPT_RESUME, else RESUME_SIZE */
+    unsigned long long resume; /* the transfer's id in the SYN, the offset to resume from in the SYN-ACK */
+    int hashLen;           /* -1 without OPT_HASH, else HASH_SIZE in the SYN or 1 in the SYN-ACK */
+    unsigned char hash[DIGEST_SIZE];
+    long long hashSize;    /* the size of the file hashed */
+    bool stored;           /* the server has the content already */
+    int deltaLen;          /* -1 without OPT_DELTA, else DELTA_SIZE in the SYN or DELTA_ANSWER in the SYN-ACK */
+    unsigned long long deltaId;
+    long long deltaSize;   /* the file's size in the SYN, the base's in the SYN-ACK */
+    int deltaBlock;        /* the signature's block size */
+    int deltaBlocks;       /* and its blocks, each with a rolling and a strong sum */
+    unsigned int sigWeak[SIG_MAX];
+    unsigned char sigStrong[SIG_MAX][STRONG_SIZE];
+};
+
+// DESCRIPTION: Appends an option whose value is the low len bytes of value. Returns the new length of buf.
+static int optPut(char *buf, int at, int type, unsigned int value, int len)
+{
+    buf[at++] = type;
+    buf[at++] = len;
+    for (int i = len - 1; i >= 0; i--)
+        buf[at++] = (value >> (8 * i)) & 0xff;
+    return at;
+}
+
+// DESCRIPTION: Writes the options for o into buf. Returns their length, 0 if there are none.
+static int optsWrite(char *buf, struct synOpts *o)
+{
+    int len = 0;
+    if (o->features & ~(EXT_SR | EXT_NAK))
+        len = optPut(buf, len, OPT_FEATURES, o->features & ~(EXT_SR | EXT_NAK), 4);
+    if (o->features & EXT_SR)
+        len = optPut(buf, len, OPT_ACK, (o->features & EXT_NAK) ? ACK_NAK : ACK_MARKED, 1);
+    if (o->wnd > 0)
+        len = optPut(buf, len, OPT_WND, o->wnd, 2);
+    if (o->mss > 0)
+        len = optPut(buf, len, OPT_MSS, o->mss, 2);
+    if (o->seqSpace > 0)
+        len = optPut(buf, len, OPT_SEQ, o->seqSpace, 4);
+    if (o->ticketLen >= 0)
+    {
+        buf[len++] = OPT_TICKET;
+        buf[len++] = o->ticketLen;
+        memcpy(buf + len, o->ticket, o->ticketLen);
+        len += o->ticketLen;
+    }
+    if (o->session)
+        len = optPut(buf, len, OPT_SESSION, 0, 0);
+    if (o->mux)
+        len = optPut(buf, len, OPT_MUX, 0, 0);
+    if (o->stripeLen >= 0)
+    {
+        unsigned long long fields[4] = {o->stripeId, o->stripes, o->stripeAt, o->stripeSize};
+        int widths[4] = {4, 2, 8, 8};
+        buf[len++] = OPT_STRIPE;
+        buf[len++] = o->stripeLen;
+        for (int f = 0; o->stripeLen == STRIPE_SIZE && f < 4; f++)
+        {
+            for (int i = widths[f] - 1; i >= 0; i--)
+                buf[len++] = (fields[f] >> (8 * i)) & 0xff;
+        }
+    }
+    if (o->resumeLen == RESUME_SIZE)
+    {
+        buf[len++] = OPT_RESUME;
+        buf[len++] = RESUME_SIZE;
+        for (int i = RESUME_SIZE - 1; i >= 0; i--)
+            buf[len++] = (o->resume >> (8 * i)) & 0xff;
+    }
+    if (o->hashLen == HASH_SIZE || o->hashLen == 1)
+    {
+        buf[len++] = OPT_HASH;
+        buf[len++] = o->hashLen;
+        if (o->hashLen == 1)
+            buf[len++] = o->stored;
+        for (int i = 0; o->hashLen == HASH_SIZE && i < DIGEST_SIZE; i++)
+            buf[len++] = o->hash[i];
+        for (int i = 7; o->hashLen == HASH_SIZE && i >= 0; i--)
+            buf[len++] = (o->hashSize >> (8 * i)) & 0xff;
+    }
+    if (o->deltaLen == DELTA_SIZE || o->deltaLen == DELTA_ANSWER)
+    {
+        bool syn = o->deltaLen == DELTA_SIZE;
+        unsigned long long fields[3] = {syn ? o->deltaId : (unsigned long long)o->deltaBlock, o->deltaSize, o->deltaBlocks};
+        int widths[3] = {syn ? 8 : 4, 8, syn ? 0 : 2};
+        buf[len++] = OPT_DELTA;
+        buf[len++] = o->deltaLen;
+        for (int f = 0; f < 3; f++)
+        {
+            for (int i = widths[f] - 1; i >= 0; i--)
+                buf[len++] = (fields[f] >> (8 * i)) & 0xff;
+        }
+    }
+    // An option's length is a byte, so the signature takes as many OPT_SIGs as it needs.
+    for (int first = 0; o->deltaLen == DELTA_ANSWER && first < o->deltaBlocks; first += SIG_PER_OPT)
+    {
+        int k = o->deltaBlocks - first < SIG_PER_OPT ? o->deltaBlocks - first : SIG_PER_OPT;
+        buf[len++] = OPT_SIG;
+        buf[len++] = 2 + k * (4 + STRONG_SIZE);
+        buf[len++] = first >> 8;
+        buf[len++] = first & 0xff;
+        for (int j = first; j < first + k; j++)
+        {
+            for (int i = 3; i >= 0; i--)
+                buf[len++] = (o->sigWeak[j] >> (8 * i)) & 0xff;
+            memcpy(buf + len, o->sigStrong[j], STRONG_SIZE);
+            len += STRONG_SIZE;
+        }
+    }
+    if (o->early > 0)
+        len = optPut(buf, len, OPT_EARLY, o->early, 2);
+    return len;
+}
+
+// DESCRIPTION: Reads the options in the len bytes of buf into o. Anything not there is left 0, and ticketLen,
+//              stripeLen, resumeLen, hashLen and deltaLen -1.
+// ANALYSIS: Parsing stops at OPT_PAD or at an option that runs past the end. OPT_EARLY's data is cut off the end
+//           as soon as the option is read, so that nothing in it is taken for an option.
+static void optsRead(const char *buf, int len, struct synOpts *o)
+{
+    memset(o, 0, sizeof(*o));
+    o->ticketLen = -1;
+    o->stripeLen = -1;
+    o->resumeLen = -1;
+    o->hashLen = -1;
+    o->deltaLen = -1;
+    for (int at = 0; at + 2 <= len && buf[at] != OPT_PAD;)
+    {
+        int type = (unsigned char)buf[at];
+        int l = (unsigned char)buf[at + 1];
+        if (at + 2 + l > len)
+            return;
+        unsigned int value = 0;
+        for (int i = 0; i < l && i < 4; i++)
+            value = (value << 8) | (unsigned char)buf[at + 2 + i];
+        if (type == OPT_FEATURES)
+            o->features |= value & ~(EXT_SR | EXT_NAK);
+        else if (type == OPT_ACK && value == ACK_MARKED)
+            o->features |= EXT_SR;
+        else if (type == OPT_ACK && value == ACK_NAK)
+            o->features |= EXT_SR | EXT_NAK;
+        else if (type == OPT_WND)
+            o->wnd = value;
+        else if (type == OPT_MSS)
+            o->mss = value;
+        else if (type == OPT_SEQ)
+            o->seqSpace = value;
+        else if (type == OPT_TICKET && (l == 0 || l == TICKET_SIZE))
+        {
+            o->ticketLen = l;
+            memcpy(o->ticket, buf + at + 2, l);
+        }
+        else if (type == OPT_EARLY && (int)value <= len - at - 2 - l)
+        {
+            o->early = value;
+            len -= value;
+        }
+        else if (type == OPT_SESSION)
+            o->session = true;
+        else if (type == OPT_MUX)
+            o->mux = true;
+        else if (type == OPT_STRIPE && (l == 0 || l == STRIPE_SIZE))
+        {
+            unsigned long long fields[4] = {0, 0, 0, 0};
+            int widths[4] = {4, 2, 8, 8};
+            for (int f = 0, k = at + 2; l == STRIPE_SIZE && f < 4; f++)
+            {
+                for (int i = 0; i < widths[f]; i++)
+                    fields[f] = (fields[f] << 8) | (unsigned char)buf[k++];
+            }
+            o->stripeLen = l;
+            o->stripeId = fields[0];
+            o->stripes = fields[1];
+            o->stripeAt = fields[2];
+            o->stripeSize = fields[3];
+        }
+        else if (type == OPT_RESUME && l == RESUME_SIZE)
+        {
+            o->resumeLen = l;
+            for (int i = 0; i < RESUME_SIZE; i++)
+                o->resume = (o->resume << 8) | (unsigned char)buf[at + 2 + i];
+        }
+        else if (type == OPT_HASH && (l == 1 || l == HASH_SIZE))
+        {
+            o->hashLen = l;
+            o->stored = l == 1 && buf[at + 2] == 1;
+            for (int i = 0; l == HASH_SIZE && i < DIGEST_SIZE; i++)
+                o->hash[i] = buf[at + 2 + i];
+            for (int i = 0; l == HASH_SIZE && i < 8; i++)
+                o->hashSize = (o->hashSize << 8) | (unsigned char)buf[at + 2 + DIGEST_SIZE + i];
+        }
+        else if (type == OPT_DELTA && (l == DELTA_SIZE || l == DELTA_ANSWER))
+        {
+            unsigned long long fields[3] = {0, 0, 0};
+            int widths[3] = {l == DELTA_SIZE ? 8 : 4, 8, l == DELTA_SIZE ? 0 : 2};
+            for (int f = 0, k = at + 2; f < 3; f++)
+            {
+                for (int i = 0; i < widths[f]; i++)
+                    fields[f] = (fields[f] << 8) | (unsigned char)buf[k++];
+            }
+            o->deltaLen = l;
+            o->deltaId = l == DELTA_SIZE ? fields[0] : 0;
+            o->deltaBlock = l == DELTA_ANSWER ? (int)fields[0] : 0;
+            o->deltaSize = fields[1];
+            o->deltaBlocks = fields[2] < SIG_MAX ? (int)fields[2] : SIG_MAX;
+        }
+        else if (type == OPT_SIG && l >= 2 && (l - 2) % (4 + STRONG_SIZE) == 0)
+        {
+            int first = ((unsigned char)buf[at + 2] << 8) | (unsigned char)buf[at + 3];
+            for (int j = 0, k = at + 4; j < (l - 2) / (4 + STRONG_SIZE) && first + j < SIG_MAX; j++)
+            {
+                o->sigWeak[first + j] = 0;
+                for (int i = 0; i < 4; i++)
+                    o->sigWeak[first + j] = (o->sigWeak[first + j] << 8) | (unsigned char)buf[k++];
+                memcpy(o->sigStrong[first + j], buf + k, STRONG_SIZE);
+                k += STRONG_SIZE;
+            }
+        }
+        at += 2 + l;
+    }
+}
+
+// =====================================
+// SHA-256: --dedup names a file's content by its digest, and --delta sends
+// the start of each base block's digest with the block's rolling sum.
+
+static const unsigned int sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+struct sha256
+{
+    unsigned int h[8];
+    unsigned char block[64];
+    int blockLen;
+    long long len; /* bytes hashed so far */
+};
+
+static unsigned int rotr(unsigned int x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+// DESCRIPTION: Starts a SHA-256 hash in s.
+static void sha256Init(struct sha256 *s)
+{
+    static const unsigned int h0[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(s->h, h0, sizeof(h0));
+    s->blockLen = 0;
+    s->len = 0;
+}
+
+// DESCRIPTION: Runs the compression function over the 64 bytes in s's block.
+static void sha256Block(struct sha256 *s)
+{
+    unsigned int w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (unsigned int)s->block[4 * i] << 24 | s->block[4 * i + 1] << 16 | s->block[4 * i + 2] << 8 | s->block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+        w[i] = w[i - 16] + (rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] + (rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+    // v holds a to h; each round shifts them along, with a new a and e.
+    unsigned int v[8];
+    memcpy(v, s->h, sizeof(v));
+    for (int i = 0; i < 64; i++)
+    {
+        unsigned int t1 = v[7] + (rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256K[i] + w[i];
+        unsigned int t2 = (rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(unsigned int));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++)
+        s->h[i] += v[i];
+}
+
+// DESCRIPTION: Adds the len bytes at data to the hash.
+static void sha256Update(struct sha256 *s, const void *data, long long len)
+{
+    const unsigned char *p = data;
+    s->len += len;
+    while (len > 0)
+    {
+        int m = len < 64 - s->blockLen ? (int)len : 64 - s->blockLen;
+        memcpy(s->block + s->blockLen, p, m);
+        s->blockLen += m;
+        p += m;
+        len -= m;
+        if (s->blockLen == 64)
+        {
+            sha256Block(s);
+            s->blockLen = 0;
+        }
+    }
+}
+
+// DESCRIPTION: Pads the hash out and writes its DIGEST_SIZE bytes into digest.
+static void sha256Final(struct sha256 *s, unsigned char *digest)
+{
+    unsigned long long bits = (unsigned long long)s->len * 8;
+    unsigned char pad[72] = {0x80};
+    int padLen = (s->blockLen < 56 ? 56 : 120) - s->blockLen;
+    for (int i = 0; i < 8; i++)
+        pad[padLen + i] = bits >> (56 - 8 * i);
+    sha256Update(s, pad, padLen + 8);
+    for (int i = 0; i < DIGEST_SIZE; i++)
+        digest[i] = s->h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+// =====================================
+// Delta Records: Under --delta the client sends, instead of its file, a
+// stream of records that rebuild it from the server's base. A block of the
+// base is matched by its rolling sum first and its SHA-256 second.
+
+#define DELTA_LIT 0     /* record: length (4 bytes), then that much of the file */
+#define DELTA_COPY 1    /* record: first block (4 bytes) and how many blocks follow it in the base (4) */
+#define DELTA_HDR 9     /* longest record header */
+
+// DESCRIPTION: Returns the rolling sum of the len bytes at p: two 16-bit sums, of the bytes and of each byte
+//              weighted by how far it is from the end.
+static unsigned int deltaWeak(const unsigned char *p, long long len)
+{
+    unsigned int a = 0, b = 0;
+    for (long long i = 0; i < len; i++)
+    {
+        a += p[i];
+        b += (len - i) * p[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+// DESCRIPTION: Writes the first STRONG_SIZE bytes of the SHA-256 of the len bytes at p into strong.
+static void deltaStrong(const unsigned char *p, long long len, unsigned char *strong)
+{
+    struct sha256 s;
+    unsigned char digest[DIGEST_SIZE];
+    sha256Init(&s);
+    sha256Update(&s, p, len);
+    sha256Final(&s, digest);
+    memcpy(strong, digest, STRONG_SIZE);
+}
+
+#endif
@@ -1,323 +1,2547 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/time.h>
-#include <fcntl.h>
-
-#include <stdbool.h>
-
-// =====================================
-
-#define RTO 500000       /* timeout in microseconds */
-#define HDR_SIZE 12      /* header size*/
-#define PKT_SIZE 524     /* total packet size */
-#define PAYLOAD_SIZE 512 /* PKT_SIZE - HDR_SIZE */
-#define WND_SIZE 10      /* window size*/
-#define MAX_SEQN 25601   /* number of sequence numbers [0-25600] */
-
-// Packet Structure: Described in Section 2.1.1 of the spec. DO NOT CHANGE!
-struct packet
-{
-    unsigned short seqnum;
-    unsigned short acknum;
-    char syn;
-    char fin;
-    char ack;
-    char dupack;
-    unsigned int length;
-    char payload[PAYLOAD_SIZE];
-};
-
-// Printing Functions: Call them on receiving/sending/packet timeout according
-// Section 2.6 of the spec. The content is already conformant with the spec,
-// no need to change. Only call them at correct times.
-void printRecv(struct packet *pkt)
-{
-    printf("RECV %d %d%s%s%s\n", pkt->seqnum, pkt->acknum, pkt->syn ? " SYN" : "", pkt->fin ? " FIN" : "", (pkt->ack || pkt->dupack) ? " ACK" : "");
-}
-
-void printSend(struct packet *pkt, int resend)
-{
-    if (resend)
-        printf("RESEND %d %d%s%s%s\n", pkt->seqnum, pkt->acknum, pkt->syn ? " SYN" : "", pkt->fin ? " FIN" : "", pkt->ack ? " ACK" : "");
-    else
-        printf("SEND %d %d%s%s%s%s\n", pkt->seqnum, pkt->acknum, pkt->syn ? " SYN" : "", pkt->fin ? " FIN" : "", pkt->ack ? " ACK" : "", pkt->dupack ? " DUP-ACK" : "");
-}
-
-void printTimeout(struct packet *pkt)
-{
-    printf("TIMEOUT %d\n", pkt->seqnum);
-}
-
-// Building a packet by filling the header and contents.
-// This function is provided to you and you can use it directly
-void buildPkt(struct packet *pkt, unsigned short seqnum, unsigned short acknum, char syn, char fin, char ack, char dupack, unsigned int length, const char *payload)
-{
-    pkt->seqnum = seqnum;
-    pkt->acknum = acknum;
-    pkt->syn = syn;
-    pkt->fin = fin;
-    pkt->ack = ack;
-    pkt->dupack = dupack;
-    pkt->length = length;
-    memcpy(pkt->payload, payload, length);
-}
-
-// =====================================
-
-double setTimer()
-{
-    struct timeval e;
-    gettimeofday(&e, NULL);
-    return (double)e.tv_sec + (double)e.tv_usec / 1000000 + (double)RTO / 1000000;
-}
-
-int isTimeout(double end)
-{
-    struct timeval s;
-    gettimeofday(&s, NULL);
-    double start = (double)s.tv_sec + (double)s.tv_usec / 1000000;
-    return ((end - start) < 0.0);
-}
-
-// =====================================
-
-int main(int argc, char *argv[])
-{
-    if (argc != 2)
-    {
-        perror("ERROR: incorrect number of arguments\n");
-        exit(1);
-    }
-
-    unsigned int servPort = atoi(argv[1]);
-
-    // =====================================
-    // Socket Setup
-
-    int sockfd;
-    struct sockaddr_in servaddr, cliaddr;
-
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servaddr.sin_port = htons(servPort);
-    memset(servaddr.sin_zero, '\0', sizeof(servaddr.sin_zero));
-
-    if (bind(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) == -1)
-    {
-        perror("bind() error");
-        exit(1);
-    }
-
-    int cliaddrlen = sizeof(cliaddr);
-
-    // NOTE: We set the socket as non-blocking so that we can poll it until
-    //       timeout instead of getting stuck. This way is not particularly
-    //       efficient in real programs but considered acceptable in this
-    //       project.
-    //       Optionally, you could also consider adding a timeout to the socket
-    //       using setsockopt with SO_RCVTIMEO instead.
-    fcntl(sockfd, F_SETFL, O_NONBLOCK);
-
-    // =====================================
-
-    unsigned short seqNum = (rand() * rand()) % MAX_SEQN;
-
-    for (int i = 1;; i++)
-    {
-        // =====================================
-        // Establish Connection: This procedure is provided to you directly and
-        // is already working.
-
-        int n;
-
-        FILE *fp;
-
-        struct packet synpkt, synackpkt, ackpkt;
-
-        while (1)
-        {
-            n = recvfrom(sockfd, &synpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, (socklen_t *)&cliaddrlen);
-            if (n > 0)
-            {
-                printRecv(&synpkt);
-                if (synpkt.syn)
-                    break;
-            }
-        }
-
-        unsigned short cliSeqNum = (synpkt.seqnum + 1) % MAX_SEQN;
-
-        buildPkt(&synackpkt, seqNum, cliSeqNum, 1, 0, 1, 0, 0, NULL);
-
-        while (1)
-        {
-            printSend(&synackpkt, 0);
-            sendto(sockfd, &synackpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-
-            while (1)
-            {
-                n = recvfrom(sockfd, &ackpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, (socklen_t *)&cliaddrlen);
-                if (n > 0)
-                {
-                    printRecv(&ackpkt);
-                    if (ackpkt.seqnum == cliSeqNum && (ackpkt.ack || ackpkt.dupack) && ackpkt.acknum == (synackpkt.seqnum + 1) % MAX_SEQN)
-                    {
-                        int length = snprintf(NULL, 0, "%d", i) + 6;
-                        char *filename = malloc(length);
-                        snprintf(filename, length, "%d.file", i);
-
-                        fp = fopen(filename, "w");
-                        free(filename);
-                        if (fp == NULL)
-                        {
-                            perror("ERROR: File could not be created\n");
-                            exit(1);
-                        }
-
-                        fwrite(ackpkt.payload, 1, ackpkt.length, fp);
-
-                        seqNum = ackpkt.acknum;
-                        cliSeqNum = (ackpkt.seqnum + ackpkt.length) % MAX_SEQN;
-
-                        buildPkt(&ackpkt, seqNum, cliSeqNum, 0, 0, 1, 0, 0, NULL);
-                        printSend(&ackpkt, 0);
-                        sendto(sockfd, &ackpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-                        break;
-                    }
-                    else if (ackpkt.syn)
-                    {
-                        buildPkt(&synackpkt, seqNum, (synpkt.seqnum + 1) % MAX_SEQN, 1, 0, 0, 1, 0, NULL);
-                        break;
-                    }
-                }
-            }
-            if (!ackpkt.syn)
-                break;
-        }
-
-        // *** TODO: Implement the rest of reliable transfer in the server ***
-        // Implement GBN for basic requirement or Selective Repeat to receive bonus
-
-        // Note: the following code is not the complete logic. It only expects
-        //       a single data packet, and then tears down the connection
-        //       without handling data loss.
-        //       Only for demo purpose. DO NOT USE IT in your final submission
-
-        struct packet recvpkt;
-
-        int si = 0;
-        int ei = 0;
-        int seen[WND_SIZE + 1];
-        for (int i = 0; i < WND_SIZE + 1; i++)
-        {
-            seen[i] = -1;
-        }
-
-        while (1)
-        {
-            n = recvfrom(sockfd, &recvpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, (socklen_t *)&cliaddrlen);
-            if (n > 0)
-            {
-                printRecv(&recvpkt);
-                if (recvpkt.fin)
-                {
-                    cliSeqNum = (cliSeqNum + 1) % MAX_SEQN;
-
-                    buildPkt(&ackpkt, seqNum, cliSeqNum, 0, 0, 1, 0, 0, NULL);
-                    printSend(&ackpkt, 0);
-                    sendto(sockfd, &ackpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-
-                    break;
-                }
-                bool isDup = false;
-                bool flag = true;
-                int i = si;
-                while (i != ei || (flag && i == ei))
-                {
-                    if (flag == true)
-                    {
-                        flag = false;
-                    }
-                    if ((recvpkt.seqnum + recvpkt.length) % MAX_SEQN == seen[i])
-                    {
-                        isDup = true;
-                        break;
-                    }
-                    i = (i + 1) % (WND_SIZE + 1);
-                }
-                if (!isDup && cliSeqNum == recvpkt.seqnum)
-                {
-                    fwrite(recvpkt.payload, 1, recvpkt.length, fp);
-                    cliSeqNum = (recvpkt.seqnum + recvpkt.length) % MAX_SEQN;
-                    seen[ei] = cliSeqNum;
-                    ei = (ei + 1) % (WND_SIZE + 1);
-                    if (si == ei)
-                    {
-                        si = (si + 1) % (WND_SIZE + 1);
-                    }
-                }
-                buildPkt(&ackpkt, seqNum, cliSeqNum, 0, 0, 1, 0, 0, NULL);
-                printSend(&ackpkt, 0);
-                sendto(sockfd, &ackpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-            }
-        }
-
-        // *** End of your server implementation ***
-
-        fclose(fp);
-        // =====================================
-        // Connection Teardown: This procedure is provided to you directly and
-        // is already working.
-
-        struct packet finpkt, lastackpkt;
-        buildPkt(&finpkt, seqNum, 0, 0, 1, 0, 0, 0, NULL);
-        buildPkt(&ackpkt, seqNum, cliSeqNum, 0, 0, 0, 1, 0, NULL);
-
-        printSend(&finpkt, 0);
-        sendto(sockfd, &finpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-        double timer = setTimer();
-
-        while (1)
-        {
-            while (1)
-            {
-                n = recvfrom(sockfd, &lastackpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, (socklen_t *)&cliaddrlen);
-                if (n > 0)
-                    break;
-
-                if (isTimeout(timer))
-                {
-                    printTimeout(&finpkt);
-                    printSend(&finpkt, 1);
-                    sendto(sockfd, &finpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-                    timer = setTimer();
-                }
-            }
-
-            printRecv(&lastackpkt);
-            if (lastackpkt.fin)
-            {
-
-                printSend(&ackpkt, 0);
-                sendto(sockfd, &ackpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-
-                printSend(&finpkt, 1);
-                sendto(sockfd, &finpkt, PKT_SIZE, 0, (struct sockaddr *)&cliaddr, cliaddrlen);
-                timer = setTimer();
-
-                continue;
-            }
-            if ((lastackpkt.ack || lastackpkt.dupack) && lastackpkt.acknum == (finpkt.seqnum + 1) % MAX_SEQN)
-                break;
-        }
-
-        seqNum = lastackpkt.acknum;
-    }
-}
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/uio.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include <stdbool.h>
+#include "proto.h"
+
+// =====================================
+
+#define RTO 500000       /* timeout in microseconds */
+#define HDR_SIZE 12      /* header size*/
+#define PKT_SIZE 524     /* total packet size */
+#define PAYLOAD_SIZE 512 /* PKT_SIZE - HDR_SIZE */
+#define WND_SIZE 10      /* window size*/
+#define MAX_SEQN 25601   /* number of sequence numbers [0-25600] */
+#define EXT_SIZE 28      /* extension trailer size */
+#define MSS_MAX 1280     /* largest segment: a default window of them must fit in half the default seq space */
+#define WND_MAX 32       /* receive slots, and so the largest window a client may agree on */
+#define SEQ_MAX 65536    /* widest seq space a client may agree on: every value a seqnum can take */
+
+#define ECN_ECT0 0x2     /* ECN field of the TOS byte: ECN-capable transport */
+#define ECN_CE 0x3       /* ECN field of the TOS byte: congestion experienced */
+#define FEC_MAX_K 8      /* largest group a parity pkt may cover */
+#define FEC_HIST 20      /* recent data pkts kept to rebuild from */
+#define FEC_GROUPS 4     /* parity pkts kept until their group can be rebuilt */
+#define NAK_RETRY 50000  /* microseconds before an unanswered NAK is repeated, until one is answered */
+#define NAK_MIN 10000    /* floor of the NAK retry interval in microseconds */
+#define NAK_TRIES 5      /* NAKs per gap before the sender's RTO is left to it */
+#define NAK_ACK_EVERY 2  /* in-order pkts per ACK under --nak */
+#define NAK_ACK_DELAY 20000 /* microseconds an in-order pkt may wait for the next before it is acked alone */
+#define MAX_CONNS 16     /* clients served at once */
+#define PULL_UNSCHED 4   /* new pkts a client may send before any credit */
+#define PULL_BUDGET 20   /* granted pkts outstanding over all connections */
+#define PULL_IDLE 100000 /* microseconds without an arrival before a connection's credit stops counting */
+
+// Packet Structure: Described in Section 2.1.1 of the spec. DO NOT CHANGE! Only the payload has
+// room past PAYLOAD_SIZE, for segments agreed on with EXT_MSS; on the wire a pkt is still the
+// first PKT_SIZE bytes of it unless it carries more.
+struct packet
+{
+    unsigned short seqnum;
+    unsigned short acknum;
+    char syn;
+    char fin;
+    char ack;
+    char dupack;
+    unsigned int length;
+    char payload[MSS_MAX];
+};
+
+// Extension Trailer: Follows the PKT_SIZE bytes of a pkt on the wire (or its longer payload, see
+// wireSize), so it is always the last EXT_SIZE bytes of the datagram. A trailer is only ever sent
+// while flags is non-zero. Bits below EXT_CE are agreed on in the SYN options, and a client that
+// offers none (the spec's) is answered without one; EXT_CE and above describe the pkt being answered.
+struct pktExt
+{
+    unsigned int flags;
+    unsigned int tsVal; /* sender clock in microseconds when the pkt left */
+    unsigned int tsEcr; /* tsVal of the pkt this one answers */
+    unsigned int tsDelay; /* microseconds the pkt being answered was held before this one left */
+    unsigned int rxCount; /* with EXT_FEC: data and parity pkts the server has received so far */
+    unsigned int credit; /* with EXT_PULL: new pkts the client may have sent so far, the first one included */
+    unsigned int gap; /* with EXT_NAKD: bytes missing from the NAK's acknum on */
+};
+
+// Printing Functions: Call them on receiving/sending/packet timeout according
+// Section 2.6 of the spec. The content is already conformant with the spec,
+// no need to change. Only call them at correct times.
+void printRecv(struct packet *pkt)
+{
+    printf("RECV %d %d%s%s%s\n", pkt->seqnum, pkt->acknum, pkt->syn ? " SYN" : "", pkt->fin ? " FIN" : "", (pkt->ack || pkt->dupack) ? " ACK" : "");
+}
+
+void printSend(struct packet *pkt, int resend)
+{
+    if (resend)
+        printf("RESEND %d %d%s%s%s\n", pkt->seqnum, pkt->acknum, pkt->syn ? " SYN" : "", pkt->fin ? " FIN" : "", pkt->ack ? " ACK" : "");
+    else
+        printf("SEND %d %d%s%s%s%s\n", pkt->seqnum, pkt->acknum, pkt->syn ? " SYN" : "", pkt->fin ? " FIN" : "", pkt->ack ? " ACK" : "", pkt->dupack ? " DUP-ACK" : "");
+}
+
+void printTimeout(struct packet *pkt)
+{
+    printf("TIMEOUT %d\n", pkt->seqnum);
+}
+
+// Building a packet by filling the header and contents.
+// This function is provided to you and you can use it directly
+void buildPkt(struct packet *pkt, unsigned short seqnum, unsigned short acknum, char syn, char fin, char ack, char dupack, unsigned int length, const char *payload)
+{
+    pkt->seqnum = seqnum;
+    pkt->acknum = acknum;
+    pkt->syn = syn;
+    pkt->fin = fin;
+    pkt->ack = ack;
+    pkt->dupack = dupack;
+    pkt->length = length;
+    memcpy(pkt->payload, payload, length);
+}
+
+// =====================================
+
+double getTime()
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return (double)t.tv_sec + (double)t.tv_usec / 1000000;
+}
+
+unsigned int toTimestamp(double t)
+{
+    return (unsigned int)(unsigned long)(t * 1000000);
+}
+
+unsigned int getTimestamp()
+{
+    return toTimestamp(getTime());
+}
+
+// Receive Metadata: What the socket tells us about a pkt besides its bytes. at is the kernel's
+// software RX timestamp when SO_TIMESTAMPING is on, otherwise the time recvPkt returned.
+struct rxMeta
+{
+    double at;
+    double lag; /* seconds from the kernel seeing the pkt to recvPkt returning it */
+    bool kernel;
+    bool ce; /* the IP header was marked congestion experienced (needs IP_RECVTOS) */
+};
+
+// Number of datagrams handed to sendPkt so far. With SOF_TIMESTAMPING_OPT_ID this is also the
+// key the kernel reports the next datagram's TX timestamp under.
+static unsigned int txCount = 0;
+
+// DESCRIPTION: Asks for the TOS byte of received pkts (IP_RECVTOS) and marks sent ones ECT(0) if ect is set, else Not-ECT.
+int enableEcn(int sockfd, bool ect)
+{
+    int on = 1;
+    int tos = ect ? ECN_ECT0 : 0;
+    if (setsockopt(sockfd, IPPROTO_IP, IP_RECVTOS, &on, sizeof(on)) < 0)
+        return -1;
+    return setsockopt(sockfd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+}
+
+// DESCRIPTION: Turns on kernel software timestamps for received pkts and, if tx is set, for sent ones.
+// ANALYSIS: Returns -1 if the kernel refuses, in which case userspace times are used as before.
+int enableKernelTs(int sockfd, bool tx)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (tx)
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    return setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+// DESCRIPTION: Returns how many bytes of pkt go on the wire ahead of the trailer. That is PKT_SIZE, unless EXT_MSS is on
+//              and the payload is longer, as it is for data pkts of a larger segment and for the SYN offering it.
+size_t wireSize(struct packet *pkt, struct pktExt *ext)
+{
+    if (!(ext->flags & EXT_MSS))
+        return PKT_SIZE;
+    return pkt->length > PAYLOAD_SIZE ? HDR_SIZE + pkt->length : PKT_SIZE;
+}
+
+// DESCRIPTION: Sends pkt, followed by the extension trailer stamped with tsVal if ext->flags is set.
+ssize_t sendPktTs(int sockfd, struct packet *pkt, struct pktExt *ext, unsigned int tsVal, struct sockaddr_in *addr, int addrlen)
+{
+    char buf[sizeof(struct packet) + EXT_SIZE];
+    size_t len = wireSize(pkt, ext);
+    memcpy(buf, pkt, len);
+    if (ext->flags != 0)
+    {
+        ext->tsVal = tsVal;
+        memcpy(buf + len, ext, EXT_SIZE);
+        len += EXT_SIZE;
+    }
+    ssize_t n = sendto(sockfd, buf, len, 0, (struct sockaddr *)addr, addrlen);
+    if (n > 0)
+        txCount++;
+    return n;
+}
+
+// DESCRIPTION: Sends pkt, followed by the extension trailer if ext->flags is set. tsVal is stamped here.
+ssize_t sendPkt(int sockfd, struct packet *pkt, struct pktExt *ext, struct sockaddr_in *addr, int addrlen)
+{
+    return sendPktTs(sockfd, pkt, ext, getTimestamp(), addr, addrlen);
+}
+
+// DESCRIPTION: Receives a pkt along with its extension trailer, if any, and its metadata. Returns what recvmsg returns.
+// ANALYSIS: ext->flags is 0 when the pkt came without a trailer.
+ssize_t recvPkt(int sockfd, struct packet *pkt, struct pktExt *ext, struct rxMeta *meta, struct sockaddr_in *addr, int *addrlen)
+{
+    char buf[sizeof(struct packet) + EXT_SIZE];
+    char ctrl[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {buf, sizeof(buf)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = *addrlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    ssize_t n = recvmsg(sockfd, &msg, 0);
+    memset(ext, 0, sizeof(*ext));
+    if (n <= 0)
+        return n;
+    *addrlen = msg.msg_namelen;
+
+    meta->at = getTime();
+    meta->lag = 0;
+    meta->kernel = false;
+    meta->ce = false;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING)
+        {
+            struct scm_timestamping *st = (struct scm_timestamping *)CMSG_DATA(cm);
+            if (st->ts[0].tv_sec != 0)
+            {
+                double at = (double)st->ts[0].tv_sec + (double)st->ts[0].tv_nsec / 1000000000;
+                meta->lag = meta->at - at;
+                meta->at = at;
+                meta->kernel = true;
+            }
+        }
+        else if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TOS)
+        {
+            meta->ce = (*(unsigned char *)CMSG_DATA(cm) & ECN_CE) == ECN_CE;
+        }
+    }
+
+    size_t body = n;
+    if (n >= PKT_SIZE + EXT_SIZE)
+    {
+        body = n - EXT_SIZE;
+        memcpy(ext, buf + body, EXT_SIZE);
+    }
+    memcpy(pkt, buf, body < sizeof(*pkt) ? body : sizeof(*pkt));
+    return n;
+}
+
+// =====================================
+
+double setTimer()
+{
+    struct timeval e;
+    gettimeofday(&e, NULL);
+    return (double)e.tv_sec + (double)e.tv_usec / 1000000 + (double)RTO / 1000000;
+}
+
+int isTimeout(double end)
+{
+    struct timeval s;
+    gettimeofday(&s, NULL);
+    double start = (double)s.tv_sec + (double)s.tv_usec / 1000000;
+    return ((end - start) < 0.0);
+}
+
+// =====================================
+
+// Timing Stats: Where a connection's time went between pkts arriving and their ACKs leaving, printed
+// to stderr with --stats. rxLag is the kernel seeing a pkt to recvPkt returning it (our polling and
+// scheduling); hold is the kernel seeing it to its ACK being sent (printRecv, fwrite and the rest).
+struct timingStats
+{
+    int acks;
+    double holdSum;
+    double holdMax;
+    int rxs;
+    double rxLagSum;
+    int ces;  /* pkts that arrived CE-marked */
+    int sels; /* pkts acked selectively */
+};
+
+// DESCRIPTION: Fills in the trailer fields about the pkt described by rx ahead of the ACK for it: how long the pkt was
+//              held and, with ECN, whether it arrived CE-marked.
+void stampAck(struct pktExt *ext, struct rxMeta *rx, struct timingStats *st)
+{
+    double held = getTime() - rx->at;
+    if (held < 0)
+        held = 0;
+    ext->tsDelay = (unsigned int)(held * 1000000);
+    st->acks++;
+    st->holdSum += held;
+    if (held > st->holdMax)
+        st->holdMax = held;
+    ext->flags &= ~EXT_CE;
+    if ((ext->flags & EXT_ECN) && rx->ce)
+    {
+        ext->flags |= EXT_CE;
+        st->ces++;
+    }
+}
+
+// =====================================
+// Resumption Tickets: A client that asks in its SYN gets a ticket in the
+// SYN-ACK, and may redeem it on a later SYN to send the start of its file
+// with the SYN and the rest of the initial window right behind, before our
+// SYN-ACK is back (0-RTT). The SYN-ACK then acks the SYN's data too, which is
+// how the client learns it was taken. A ticket binds the client's address
+// and the time it was issued under a key drawn at startup, so tickets die
+// with the server and after TICKET_LIFETIME; the MAC keeps out stale and
+// copied tickets, not a determined forger. Each ticket is taken once: a
+// replayed SYN gets the ordinary handshake and its data is ignored.
+
+#define TICKET_LIFETIME 3600 /* seconds a ticket may be redeemed for after it was issued */
+#define TICKET_USED 64       /* redeemed tickets remembered, so that none is taken twice */
+
+struct tickets
+{
+    unsigned long long key;
+    unsigned int serial;                  /* tickets issued so far */
+    unsigned long long used[TICKET_USED]; /* MACs of the tickets redeemed last */
+    int usedNext;
+};
+
+// DESCRIPTION: Returns a key drawn from /dev/urandom, or from the time and pid if it cannot be read.
+unsigned long long drawKey()
+{
+    unsigned long long key;
+    FILE *f = fopen("/dev/urandom", "r");
+    if (f == NULL || fread(&key, sizeof(key), 1, f) != 1)
+        key = ((unsigned long long)getpid() << 32) ^ (unsigned long long)(getTime() * 1000000);
+    if (f != NULL)
+        fclose(f);
+    return key;
+}
+
+// DESCRIPTION: Returns a MAC of the n words under key.
+// ANALYSIS: Each word is folded in through the splitmix64 finaliser, keyed at every step.
+unsigned long long keyedHash(unsigned long long key, const unsigned int *words, int n)
+{
+    unsigned long long h = key;
+    for (int i = 0; i < n; i++)
+    {
+        h ^= key + words[i];
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+void ticketsInit(struct tickets *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->key = drawKey();
+}
+
+// DESCRIPTION: Returns the MAC of a ticket issued at time at, with serial serial, to the client at ip.
+unsigned long long ticketMac(struct tickets *t, unsigned int ip, unsigned int at, unsigned int serial)
+{
+    unsigned int words[3] = {ip, at, serial};
+    return keyedHash(t->key, words, 3);
+}
+
+// DESCRIPTION: Writes a new ticket for the client at addr into ticket: issue time and serial (4 bytes each) and the
+//              MAC (8 bytes), most significant first.
+void ticketIssue(struct tickets *t, struct sockaddr_in *addr, unsigned char *ticket)
+{
+    unsigned int at = (unsigned int)getTime();
+    unsigned int serial = t->serial++;
+    unsigned long long mac = ticketMac(t, addr->sin_addr.s_addr, at, serial);
+    for (int i = 0; i < 4; i++)
+    {
+        ticket[i] = at >> (24 - 8 * i);
+        ticket[4 + i] = serial >> (24 - 8 * i);
+    }
+    for (int i = 0; i < 8; i++)
+        ticket[8 + i] = mac >> (56 - 8 * i);
+}
+
+// DESCRIPTION: Returns true, and remembers the ticket as taken, if ticket was issued by us to the client at addr,
+//              has not expired and has not been taken before.
+bool ticketRedeem(struct tickets *t, struct sockaddr_in *addr, const unsigned char *ticket)
+{
+    unsigned int at = 0, serial = 0;
+    unsigned long long mac = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        at = (at << 8) | ticket[i];
+        serial = (serial << 8) | ticket[4 + i];
+    }
+    for (int i = 0; i < 8; i++)
+        mac = (mac << 8) | ticket[8 + i];
+
+    unsigned int now = (unsigned int)getTime();
+    if (mac != ticketMac(t, addr->sin_addr.s_addr, at, serial) || now - at > TICKET_LIFETIME)
+        return false;
+    for (int i = 0; i < TICKET_USED; i++)
+    {
+        if (t->used[i] == mac)
+            return false;
+    }
+    t->used[t->usedNext] = mac;
+    t->usedNext = (t->usedNext + 1) % TICKET_USED;
+    return true;
+}
+
+// =====================================
+// SYN Cookies: With --syn-cookies a SYN takes no slot. Our SYN-ACK's seqnum
+// is a cookie, a MAC of the client's address and ISN, the features agreed and
+// a coarse clock, and the connection is only set up once the handshake's last
+// step brings it back in its acknum. The client's trailer then says which
+// features were agreed; the window, segment and seq space, which it has no
+// room for, ride in the SYN-ACK's tsVal and come back in the tsEcr, so they
+// are only agreed beyond the defaults with --ts. The ISN leaves room for a
+// MAC of about 13 bits and the clock's parity: a guessed cookie gets through
+// one time in 12800, and a cookie is good for one to two COOKIE_SLOTs.
+// Whether the stream is a session, and multiplexed, comes back nowhere, so
+// the cookie covers it beside the features and each way is tried. A SYN that
+// redeems a ticket brings data and has shown it is no flood, so it still
+// takes its slot at once.
+
+#define COOKIE_SLOT 64            /* seconds per tick of the clock cookies are made with */
+#define COOKIE_SESSION 0x10000000 /* beside the features a cookie covers: OPT_SESSION was agreed */
+#define COOKIE_MUX 0x20000000     /* and OPT_MUX */
+
+struct cookies
+{
+    bool on;
+    unsigned long long key;
+};
+
+// DESCRIPTION: Returns the cookie for the client at addr with ISN isn, agreeing to features and, packed in params,
+//              any window, segment and seq space, in clock tick slot.
+unsigned short cookieMake(struct cookies *k, struct sockaddr_in *addr, unsigned short isn, unsigned int features, unsigned int params, unsigned int slot)
+{
+    unsigned int words[6] = {addr->sin_addr.s_addr, addr->sin_port, isn, features, params, slot};
+    return keyedHash(k->key, words, 6) % (MAX_SEQN / 2) * 2 + (slot & 1);
+}
+
+// DESCRIPTION: Returns true if cookie is the one made for these in the current clock tick or the one before.
+bool cookieCheck(struct cookies *k, struct sockaddr_in *addr, unsigned short isn, unsigned int features, unsigned int params, unsigned short cookie)
+{
+    unsigned int slot = (unsigned int)getTime() / COOKIE_SLOT;
+    if ((slot & 1) != (cookie & 1u))
+        slot--;
+    return cookieMake(k, addr, isn, features, params, slot) == cookie;
+}
+
+// DESCRIPTION: Packs the window, segment and seq space into a tsVal: wnd-1 in 5 bits, the segment past PAYLOAD_SIZE
+//              in 10 and the seq space past MAX_SEQN in 16.
+unsigned int cookieParams(int wnd, int mss, int seqSpace)
+{
+    return (wnd - 1) | (mss - PAYLOAD_SIZE) << 5 | (seqSpace - MAX_SEQN) << 15;
+}
+
+// =====================================
+// Modes: Under GBN the next pkt in order is the only one taken and every ACK
+// is cumulative. Under SR pkts past a gap are held in the window and each
+// one is acked by itself. A client that agreed to EXT_SR picks per pkt with
+// EXT_SEL, so it can move from one to the other mid-file; for any other
+// client --mode (GBN unless built otherwise) decides.
+
+#define MODE_GBN 0
+#define MODE_SR 1
+
+#ifndef DEFAULT_MODE
+#define DEFAULT_MODE MODE_GBN /* selective_repeat/Makefile builds with -DDEFAULT_MODE=MODE_SR */
+#endif
+
+// DESCRIPTION: Returns how far seqnum lies past base in a seq space of the given size, negative if it lies before it.
+// ANALYSIS: Sequence numbers wrap at space, so anything more than half of it ahead is taken to be behind.
+int seqOffset(unsigned short seqnum, unsigned short base, int space)
+{
+    int off = ((int)seqnum - base + space) % space;
+    return off > space / 2 ? off - space : off;
+}
+
+// DESCRIPTION: Returns the index of the received pkt with the given seqnum. Else, returns -1.
+// ANALYSIS: Segments may differ in size, so a pkt's slot says nothing about its seqnum and every slot is checked.
+int getRcvdPktIdx(bool *rcvd, struct packet *pkts, unsigned short seqnum)
+{
+    for (int i = 0; i < WND_MAX; i++)
+    {
+        if (rcvd[i] && pkts[i].seqnum == seqnum)
+            return i;
+    }
+    return -1;
+}
+
+// DESCRIPTION: Returns the first index not holding a received pkt. Else, returns -1.
+int getFreeIdx(bool *rcvd)
+{
+    for (int i = 0; i < WND_MAX; i++)
+    {
+        if (!rcvd[i])
+            return i;
+    }
+    return -1;
+}
+
+// =====================================
+// Forward Error Correction: A parity pkt covers the group of pkts its acknum
+// counts, PAYLOAD_SIZE apart from its seqnum on. Its payload and length are
+// the XOR of theirs, so with every pkt of the group but one at hand, the
+// XOR of parity and the rest is the missing one. Recent data pkts are kept
+// for this whatever the receiver made of them (GBN drops those past a gap),
+// and a parity pkt whose group is still short of two waits for more.
+// Rebuilt pkts, and with GBN the held ones they make next in order, are
+// queued to go through the receiver as if they had just arrived.
+
+struct fecState
+{
+    bool on;
+    int seqSpace;
+    struct packet held[FEC_HIST];
+    int heldN;
+    int heldI;                         /* slot the next held pkt goes in */
+    struct packet parity[FEC_GROUPS];
+    bool pending[FEC_GROUPS];
+    int parityI;
+    struct packet out[FEC_HIST];       /* pkts queued for the receiver */
+    int outN;
+    int outI;
+    int parities;
+    int rebuilt;
+};
+
+// DESCRIPTION: Returns the held pkt with the given seqnum, or NULL.
+struct packet *fecFind(struct fecState *f, unsigned short seqnum)
+{
+    for (int i = 0; i < f->heldN; i++)
+    {
+        if (f->held[i].seqnum == seqnum)
+            return &f->held[i];
+    }
+    return NULL;
+}
+
+// DESCRIPTION: Keeps a copy of a data pkt to rebuild from, evicting the oldest.
+void fecHold(struct fecState *f, struct packet *pkt)
+{
+    if (!f->on || fecFind(f, pkt->seqnum) != NULL)
+        return;
+    f->held[f->heldI] = *pkt;
+    f->heldI = (f->heldI + 1) % FEC_HIST;
+    if (f->heldN < FEC_HIST)
+        f->heldN++;
+}
+
+// DESCRIPTION: Queues a pkt for the receiver.
+void fecQueue(struct fecState *f, struct packet *pkt)
+{
+    if (f->outN < FEC_HIST)
+        f->out[f->outN++] = *pkt;
+}
+
+// DESCRIPTION: Rebuilds the one pkt missing from par's group into out. Returns 1 if it did, 0 if the group is complete
+//              and -1 if more than one pkt is missing.
+// ANALYSIS: Payload bytes past a pkt's length are not data, so only its first length bytes enter the XOR.
+int fecRebuild(struct fecState *f, struct packet *par, struct packet *out)
+{
+    if (par->acknum == 0 || par->acknum > FEC_MAX_K)
+        return 0;
+    int missing = -1;
+    for (int j = 0; j < par->acknum; j++)
+    {
+        if (fecFind(f, (par->seqnum + j * PAYLOAD_SIZE) % f->seqSpace) != NULL)
+            continue;
+        if (missing >= 0)
+            return -1;
+        missing = j;
+    }
+    if (missing < 0)
+        return 0;
+
+    buildPkt(out, (par->seqnum + missing * PAYLOAD_SIZE) % f->seqSpace, 0, 0, 0, 0, 0, 0, NULL);
+    out->length = par->length;
+    memcpy(out->payload, par->payload, PAYLOAD_SIZE);
+    for (int j = 0; j < par->acknum; j++)
+    {
+        if (j == missing)
+            continue;
+        struct packet *p = fecFind(f, (par->seqnum + j * PAYLOAD_SIZE) % f->seqSpace);
+        for (unsigned int b = 0; b < p->length && b < PAYLOAD_SIZE; b++)
+            out->payload[b] ^= p->payload[b];
+        out->length ^= p->length;
+    }
+    return out->length <= PAYLOAD_SIZE ? 1 : 0;
+}
+
+// DESCRIPTION: Tries every waiting parity pkt against what is held and queues the pkts it rebuilds.
+void fecPoll(struct fecState *f)
+{
+    for (int i = 0; i < FEC_GROUPS; i++)
+    {
+        if (!f->pending[i])
+            continue;
+        struct packet out;
+        int r = fecRebuild(f, &f->parity[i], &out);
+        if (r < 0)
+            continue;
+        f->pending[i] = false;
+        if (r > 0)
+        {
+            fecHold(f, &out);
+            fecQueue(f, &out);
+            f->rebuilt++;
+        }
+    }
+}
+
+// DESCRIPTION: Takes in a parity pkt, evicting the oldest one still waiting.
+void fecOnParity(struct fecState *f, struct packet *par)
+{
+    f->parity[f->parityI] = *par;
+    f->pending[f->parityI] = true;
+    f->parityI = (f->parityI + 1) % FEC_GROUPS;
+    f->parities++;
+    fecPoll(f);
+}
+
+// =====================================
+// Fountain Mode: With --mode fountain the file after the first pkt is cut
+// into k blocks and sent as an endless stream of LT-coded symbols, each the
+// XOR of a few blocks picked by a generator seeded with the symbol's id.
+// The server peels the blocks out as symbols arrive and, with slightly more
+// than k of them, has the file; it then sends the one ACK that covers it
+// all. Symbols are neither acked nor resent, so the time taken depends on
+// the loss rate only, not on RTTs spent finding out what was lost.
+
+#define FTN_C 0.1        /* robust soliton tuning: scale of the extra low degrees */
+#define FTN_DELTA 0.5    /* robust soliton tuning: allowed chance of decoding needing many more symbols */
+
+// DESCRIPTION: Steps the generator both sides derive a symbol's neighbours from (xorshift32).
+unsigned int ftnRand(unsigned int *state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// DESCRIPTION: Returns the cumulative robust soliton distribution over degrees 1..k for k blocks (cdf[d - 1] is the
+//              chance of a degree up to d), or NULL for k == 0. The caller frees it.
+// ANALYSIS: The ideal soliton alone leaves the decoder stuck too often; the extra weight on low degrees and the spike
+//           at k/R keep a degree-one symbol available while decoding, at a few percent more symbols.
+double *ftnDegreeCdf(int k)
+{
+    if (k == 0)
+        return NULL;
+    double *cdf = malloc(k * sizeof(double));
+    double r = FTN_C * log(k / FTN_DELTA) * sqrt(k);
+    int spike = r > 0 ? (int)(k / r) : 0;
+    double sum = 0;
+    for (int d = 1; d <= k; d++)
+    {
+        double mu = d == 1 ? 1.0 / k : 1.0 / ((double)d * (d - 1));
+        if (d < spike)
+            mu += r / ((double)d * k);
+        else if (d == spike)
+            mu += r * log(r / FTN_DELTA) / k;
+        sum += mu;
+        cdf[d - 1] = sum;
+    }
+    for (int d = 0; d < k; d++)
+        cdf[d] /= sum;
+    return cdf;
+}
+
+// DESCRIPTION: Fills nbrs with the distinct blocks symbol id is the XOR of and returns how many there are.
+int ftnNeighbours(unsigned int id, int k, double *cdf, int *nbrs)
+{
+    unsigned int state = id * 2654435761u ^ 0x9e3779b9;
+    if (state == 0)
+        state = 1;
+    double u = (double)ftnRand(&state) / 4294967296.0;
+    int deg = 1;
+    while (deg < k && cdf[deg - 1] < u)
+        deg++;
+    for (int j = 0; j < deg; j++)
+    {
+        bool again = true;
+        while (again)
+        {
+            nbrs[j] = ftnRand(&state) % k;
+            again = false;
+            for (int i = 0; i < j; i++)
+            {
+                if (nbrs[i] == nbrs[j])
+                    again = true;
+            }
+        }
+    }
+    return deg;
+}
+
+// A symbol not yet reduced to a block: data is the XOR of the blocks in nbrs that are still unknown.
+struct ftnSymbol
+{
+    char data[PAYLOAD_SIZE];
+    int *nbrs;
+    int deg;
+};
+
+struct ftnDecoder
+{
+    bool on;
+    unsigned int length;
+    int k;
+    double *cdf;
+    int *nbrs;           /* scratch for ftnNeighbours */
+    char *blocks;
+    bool *known;
+    int decoded;
+    struct ftnSymbol *syms;
+    int symN;
+    int symCap;
+    int **uses;          /* per block, the symbols that still count it among their nbrs */
+    int *usesN;
+    int *usesCap;
+    int *ripple;         /* symbols down to one unknown block */
+    int rippleN;
+    int received;
+    int needed;          /* symbols received by the time the last block was decoded */
+    bool written;
+};
+
+// DESCRIPTION: Sets the decoder up for a file of the given length once the first symbol says what it is.
+void ftnStart(struct ftnDecoder *d, unsigned int length)
+{
+    memset(d, 0, sizeof(*d));
+    d->on = true;
+    d->length = length;
+    d->k = (length + PAYLOAD_SIZE - 1) / PAYLOAD_SIZE;
+    d->cdf = ftnDegreeCdf(d->k);
+    d->nbrs = malloc((d->k + 1) * sizeof(int));
+    d->blocks = calloc((size_t)d->k + 1, PAYLOAD_SIZE);
+    d->known = calloc(d->k + 1, sizeof(bool));
+    d->uses = calloc(d->k + 1, sizeof(int *));
+    d->usesN = calloc(d->k + 1, sizeof(int));
+    d->usesCap = calloc(d->k + 1, sizeof(int));
+}
+
+// DESCRIPTION: Decodes blocks for as long as some symbol is down to one unknown block, XORing each decoded
+//              block out of every other symbol that has it.
+void ftnPeel(struct ftnDecoder *d)
+{
+    while (d->rippleN > 0)
+    {
+        struct ftnSymbol *s = &d->syms[d->ripple[--d->rippleN]];
+        if (s->deg != 1)
+            continue;
+        int b = s->nbrs[0];
+        s->deg = 0;
+        memcpy(d->blocks + (size_t)b * PAYLOAD_SIZE, s->data, PAYLOAD_SIZE);
+        d->known[b] = true;
+        d->decoded++;
+        for (int i = 0; i < d->usesN[b]; i++)
+        {
+            int u = d->uses[b][i];
+            struct ftnSymbol *o = &d->syms[u];
+            if (o->deg == 0)
+                continue;
+            for (int j = 0; j < o->deg; j++)
+            {
+                if (o->nbrs[j] == b)
+                {
+                    o->nbrs[j] = o->nbrs[--o->deg];
+                    break;
+                }
+            }
+            for (int j = 0; j < PAYLOAD_SIZE; j++)
+                o->data[j] ^= s->data[j];
+            if (o->deg == 1)
+                d->ripple[d->rippleN++] = u;
+        }
+        free(d->uses[b]);
+        d->uses[b] = NULL;
+        d->usesN[b] = 0;
+    }
+}
+
+// DESCRIPTION: Takes in a symbol: XORs out the blocks already known, keeps it if any unknown are left and peels.
+void ftnAdd(struct ftnDecoder *d, struct packet *sym)
+{
+    if (!d->on)
+        ftnStart(d, sym->length);
+    d->received++;
+    if (d->decoded == d->k)
+        return;
+
+    unsigned int id = sym->seqnum | (unsigned int)sym->acknum << 16;
+    int deg = ftnNeighbours(id, d->k, d->cdf, d->nbrs);
+    if (d->symN == d->symCap)
+    {
+        d->symCap = d->symCap == 0 ? d->k + 16 : 2 * d->symCap;
+        d->syms = realloc(d->syms, d->symCap * sizeof(struct ftnSymbol));
+        d->ripple = realloc(d->ripple, d->symCap * sizeof(int));
+    }
+    int t = d->symN;
+    struct ftnSymbol *s = &d->syms[t];
+    memcpy(s->data, sym->payload, PAYLOAD_SIZE);
+    s->nbrs = malloc(deg * sizeof(int));
+    s->deg = 0;
+    for (int j = 0; j < deg; j++)
+    {
+        int b = d->nbrs[j];
+        if (d->known[b])
+        {
+            for (int i = 0; i < PAYLOAD_SIZE; i++)
+                s->data[i] ^= d->blocks[(size_t)b * PAYLOAD_SIZE + i];
+            continue;
+        }
+        s->nbrs[s->deg++] = b;
+    }
+    if (s->deg == 0)
+    {
+        free(s->nbrs);
+        return;
+    }
+    d->symN++;
+    for (int j = 0; j < s->deg; j++)
+    {
+        int b = s->nbrs[j];
+        if (d->usesN[b] == d->usesCap[b])
+        {
+            d->usesCap[b] = d->usesCap[b] == 0 ? 8 : 2 * d->usesCap[b];
+            d->uses[b] = realloc(d->uses[b], d->usesCap[b] * sizeof(int));
+        }
+        d->uses[b][d->usesN[b]++] = t;
+    }
+    if (s->deg == 1)
+        d->ripple[d->rippleN++] = t;
+    ftnPeel(d);
+    if (d->decoded == d->k)
+        d->needed = d->received;
+}
+
+void ftnFree(struct ftnDecoder *d)
+{
+    if (!d->on)
+        return;
+    for (int i = 0; i < d->symN; i++)
+        free(d->syms[i].nbrs);
+    for (int b = 0; b < d->k; b++)
+        free(d->uses[b]);
+    free(d->syms);
+    free(d->ripple);
+    free(d->uses);
+    free(d->usesN);
+    free(d->usesCap);
+    free(d->known);
+    free(d->blocks);
+    free(d->nbrs);
+    free(d->cdf);
+}
+
+// =====================================
+
+// NAKs: With EXT_NAK the receiver tells the sender which pkts it is missing,
+// instead of leaving each loss to the sender's RTO. Segments may differ in
+// size, so the receiver cannot tell the seqnums of pkts it never saw; what it
+// knows is the gap in front of each pkt it holds. Once a pkt lands past a gap,
+// the gap is NAKed once as a range (its first byte in acknum, its length in
+// the trailer), and the sender resends whatever of its own lies in it. A NAK
+// that goes unanswered is repeated on our own timer, at twice the smoothed
+// time a NAK has taken to be answered, at most NAK_TRIES times. NAKs name what
+// is missing, so the ACKs only have to move the window: they are cumulative
+// and go out for every NAK_ACK_EVERY in-order pkts, or after NAK_ACK_DELAY for
+// a lone one.
+
+struct nakRange
+{
+    unsigned short start; /* first byte of the gap when it was first NAKed */
+    int len;              /* bytes in the gap then, 0 if the entry is free */
+    double at;            /* when it was last NAKed */
+    int tries;
+};
+
+struct nakState
+{
+    bool on;
+    int seqSpace;
+    struct nakRange ranges[WND_MAX]; /* a gap lies in front of each held pkt at most */
+    double avg;            /* smoothed seconds from a NAK to the pkt it names */
+    double retry;          /* seconds before an unanswered NAK is repeated */
+    int pending;           /* in-order pkts not acked yet */
+    double ackAt;          /* when the delayed ACK for them is due, 0 if none */
+    int sent;
+};
+
+void nakInit(struct nakState *k, bool on, int seqSpace)
+{
+    memset(k, 0, sizeof(*k));
+    k->on = on;
+    k->seqSpace = seqSpace;
+    k->retry = (double)NAK_RETRY / 1000000;
+}
+
+// DESCRIPTION: NAKs the gap bytes from missing on, which lie in the given range.
+void nakSend(int sockfd, struct nakState *k, unsigned short seqNum, struct nakRange *r, unsigned short missing, int gap, struct pktExt *ext, struct sockaddr_in *addr, int addrlen)
+{
+    struct packet nakpkt;
+    buildPkt(&nakpkt, seqNum, missing, 0, 0, 0, 0, 0, NULL);
+    printSend(&nakpkt, r->tries > 0);
+    ext->flags |= EXT_NAKD;
+    ext->gap = gap;
+    sendPkt(sockfd, &nakpkt, ext, addr, addrlen);
+    ext->flags &= ~EXT_NAKD;
+    ext->gap = 0;
+    r->at = getTime();
+    r->tries++;
+    k->sent++;
+}
+
+// DESCRIPTION: Returns the NAKed range that covers the byte off bytes past base, or NULL if none does.
+struct nakRange *nakFind(struct nakState *k, unsigned short base, int off)
+{
+    for (int i = 0; i < WND_MAX; i++)
+    {
+        struct nakRange *r = &k->ranges[i];
+        int start = seqOffset(r->start, base, k->seqSpace);
+        if (r->len > 0 && start <= off && off < start + r->len)
+            return r;
+    }
+    return NULL;
+}
+
+// DESCRIPTION: Returns a free range entry, after dropping those that lie wholly before base.
+// ANALYSIS: There are never more gaps than held pkts, so one is always free.
+struct nakRange *nakAlloc(struct nakState *k, unsigned short base)
+{
+    struct nakRange *slot = &k->ranges[0];
+    for (int i = 0; i < WND_MAX; i++)
+    {
+        struct nakRange *r = &k->ranges[i];
+        if (r->len > 0 && seqOffset(r->start, base, k->seqSpace) + r->len <= 0)
+            r->len = 0;
+        if (r->len == 0)
+            slot = r;
+    }
+    memset(slot, 0, sizeof(*slot));
+    return slot;
+}
+
+// DESCRIPTION: Notes the arrival of the pkt with the given seqnum, base being the next byte expected before it.
+//              Returns true if it had been NAKed.
+// ANALYSIS: Only the first pkt of a range NAKed once is a sample, as with Karn's rule for resent pkts.
+bool nakOnArrival(struct nakState *k, unsigned short base, unsigned short seqnum)
+{
+    struct nakRange *r = nakFind(k, base, seqOffset(seqnum, base, k->seqSpace));
+    if (r == NULL)
+        return false;
+    if (r->tries == 1 && seqnum == r->start)
+    {
+        double sample = getTime() - r->at;
+        k->avg = k->avg == 0 ? sample : 0.875 * k->avg + 0.125 * sample;
+        k->retry = 2 * k->avg;
+        if (k->retry < (double)NAK_MIN / 1000000)
+            k->retry = (double)NAK_MIN / 1000000;
+    }
+    return true;
+}
+
+// =====================================
+// Pull: With EXT_PULL the server decides who sends. After the handshake a
+// client may send PULL_UNSCHED new pkts of its own accord, and beyond that
+// only as many as the credit we last told it of, which every pkt we send
+// carries in its trailer. Credits are handed out as pkts arrive, so they
+// follow the rate at which we drain the socket, and always to the
+// connection with the fewest outstanding, so that each gets an equal share.
+// However many clients upload at once, no more than PULL_BUDGET granted pkts
+// are on their way to us, plus the unscheduled pkts of clients that just
+// connected. Resent pkts need no credit; the client's loss recovery paces
+// them. A connection that has seen no arrival for PULL_IDLE (its pkts were
+// lost, or it has nothing left to send) no longer counts against the budget.
+// One that has seen none for an RTO is sent its credit again, in case the
+// pkt that carried it was lost.
+
+struct pullState
+{
+    bool on;
+    unsigned int arrived; /* new pkts taken into the window so far, the first one included */
+    unsigned int told;    /* credit the client was last sent */
+    double lastArrival;
+    double grantAt;       /* when the last grant pkt went out */
+    int grants;           /* grant pkts sent */
+};
+
+// =====================================
+// Sessions: A client that offers OPT_SESSION sends many files as one stream,
+// each behind a header: the length of its name (2 bytes), its own length (8
+// bytes), most significant first, and the name. The stream is split back up
+// as it is written out in order, into <fileNo>.session/, each file under the
+// name it came with, a '/' in it or a leading '.' made a '_' so that none
+// lands outside the directory. With OPT_MUX as well, the client sends up to
+// MUX_MAX such streams at once, interleaved in frames: the stream's number
+// (2 bytes), the length (2 bytes) and that much of it. Each stream is split
+// up on its own, so their files are written side by side; a frame for a
+// stream past MUX_MAX is dropped.
+
+#define SESS_HDR 10       /* fixed part of a file's header: name length and file length */
+#define SESS_NAME_MAX 255 /* longest name kept; the rest of a longer one is dropped */
+#define MUX_MAX 16        /* streams kept apart in a session */
+#define MUX_HDR 4         /* frame header: stream number and length */
+
+struct sessStream
+{
+    FILE *fp;       /* file being written, NULL between files */
+    long long left; /* bytes of it still to come */
+    unsigned char hdr[SESS_HDR + SESS_NAME_MAX];
+    int hdrLen;  /* bytes of the next header in so far */
+    int nameLen; /* its name's length, once the fixed part is in */
+};
+
+struct session
+{
+    bool on;
+    bool mux;
+    int files;   /* files begun so far */
+    int streams; /* the highest stream number seen, plus one */
+    struct sessStream ss[MUX_MAX];
+    unsigned char frame[MUX_HDR]; /* header of the next frame, as far as it is in */
+    int frameHdrLen;
+    int frameStream; /* stream the frame being written belongs to */
+    int frameLeft;   /* bytes of it still to come */
+};
+
+// =====================================
+// Stripes: A client with --stripes cuts a file into byte ranges and sends
+// each over a connection of its own, naming in OPT_STRIPE the transfer (an id
+// it drew), how many connections it goes over, the range's offset and the
+// file's size. The first of them to arrive opens a group that the rest join,
+// so all of them write into the same <fileNo>.file, each at its own offset
+// with pwrite; the group is forgotten once every stripe has joined. A group
+// that never fills up is pushed out by new ones, oldest first.
+
+#define STRIPE_GROUPS 16 /* striped transfers being put together at once */
+
+struct stripeGroup
+{
+    bool used;
+    unsigned int ip;
+    unsigned int id;
+    int fileNo;
+    int joined; /* stripes that have joined so far */
+    int stripes;
+    double at; /* when the group was opened */
+};
+
+// DESCRIPTION: Returns the fileNo of the striped transfer id from the client at addr, joining its group, or opening
+//              a group with fileNo if this is its first stripe.
+int stripeJoin(struct stripeGroup *groups, struct sockaddr_in *addr, unsigned int id, int stripes, int fileNo)
+{
+    struct stripeGroup *g = NULL;
+    for (int i = 0; i < STRIPE_GROUPS && g == NULL; i++)
+    {
+        if (groups[i].used && groups[i].ip == addr->sin_addr.s_addr && groups[i].id == id)
+            g = &groups[i];
+    }
+    if (g == NULL)
+    {
+        g = &groups[0];
+        for (int i = 0; i < STRIPE_GROUPS && g->used; i++)
+        {
+            if (!groups[i].used || groups[i].at < g->at)
+                g = &groups[i];
+        }
+        g->used = true;
+        g->ip = addr->sin_addr.s_addr;
+        g->id = id;
+        g->fileNo = fileNo;
+        g->joined = 0;
+        g->stripes = stripes;
+        g->at = getTime();
+    }
+    if (++g->joined >= g->stripes)
+        g->used = false;
+    return g->fileNo;
+}
+
+// =====================================
+// Resumable Transfers: A client with --resume names its transfer in
+// OPT_RESUME by an id that stays the same across restarts of either side.
+// The file goes into resume-<id>.part rather than <fileNo>.file, and every
+// CKPT_EVERY bytes it is synced to disk and how much of it is there written
+// to resume-<id>.ckpt. A client that comes back with the same id is told in
+// the SYN-ACK how far the checkpoint got and sends only the rest; whatever
+// came in past the checkpoint is written over. Once the FIN is in the file
+// is whole, so it is renamed <fileNo>.file and the checkpoint removed.
+
+#define CKPT_EVERY 262144 /* bytes received between checkpoints */
+#define RESUME_NAME 48    /* room for resume-<id>.ckpt.tmp */
+
+// DESCRIPTION: Writes the name of transfer id's file with the given suffix into name.
+void resumeName(char *name, unsigned long long id, const char *suffix)
+{
+    snprintf(name, RESUME_NAME, "resume-%016llx.%s", id, suffix);
+}
+
+// DESCRIPTION: Returns how many bytes of transfer id the last checkpoint has on disk, 0 if there is none.
+long long resumeLoad(unsigned long long id)
+{
+    char name[RESUME_NAME];
+    resumeName(name, id, "ckpt");
+    FILE *fp = fopen(name, "r");
+    if (fp == NULL)
+        return 0;
+    long long at = 0;
+    if (fscanf(fp, "%lld", &at) != 1 || at < 0)
+        at = 0;
+    fclose(fp);
+
+    // A part that has gone missing or shrunk since has less to resume from.
+    struct stat st;
+    resumeName(name, id, "part");
+    if (stat(name, &st) < 0)
+        return 0;
+    return at < st.st_size ? at : st.st_size;
+}
+
+// DESCRIPTION: Records that the first at bytes of transfer id, written to fp, are on disk.
+// ANALYSIS: The data is synced before the checkpoint that claims it, and the checkpoint is replaced by a rename,
+//           so whenever either side goes down it never claims more than the part holds.
+void resumeSave(unsigned long long id, FILE *fp, long long at)
+{
+    char name[RESUME_NAME], tmp[RESUME_NAME];
+    fflush(fp);
+    fsync(fileno(fp));
+    resumeName(name, id, "ckpt");
+    resumeName(tmp, id, "ckpt.tmp");
+    FILE *ck = fopen(tmp, "w");
+    if (ck == NULL)
+        return;
+    fprintf(ck, "%lld\n", at);
+    fflush(ck);
+    fsync(fileno(ck));
+    fclose(ck);
+    rename(tmp, name);
+}
+
+// =====================================
+// Stored Content: A client with --dedup names the file's content by its
+// SHA-256 and size in OPT_HASH. Content we have is kept in objects/<digest>,
+// a hard link to the file it first came in as. If it is there, the new
+// <fileNo>.file is linked to it (copied where links cannot be made) before
+// the SYN-ACK goes out, and the SYN-ACK tells the client to send none of it.
+// If not, what comes in is hashed on its way to the file, and stored once the
+// FIN is in if it matches, so a client cannot store content under a digest
+// that is not its own. Since stored content may be linked under any number,
+// a file is never written over in place: the old one is removed first.
+
+#define STORE_DIR "objects"
+#define STORE_PATH 80 /* room for objects/<digest in hex> */
+
+// DESCRIPTION: Writes the path content with digest is stored under into path.
+void storePath(char *path, const unsigned char *digest)
+{
+    int len = snprintf(path, STORE_PATH, "%s/", STORE_DIR);
+    for (int i = 0; i < DIGEST_SIZE; i++)
+        len += snprintf(path + len, STORE_PATH - len, "%02x", digest[i]);
+}
+
+// DESCRIPTION: Puts the stored content with digest in place as filename. Returns false if there is none of size
+//              bytes, in which case the client sends it.
+bool storeFetch(const unsigned char *digest, long long size, const char *filename)
+{
+    char path[STORE_PATH];
+    storePath(path, digest);
+    struct stat st;
+    if (stat(path, &st) < 0 || st.st_size != size)
+        return false;
+    remove(filename);
+    if (link(path, filename) == 0)
+        return true;
+
+    FILE *in = fopen(path, "r");
+    FILE *out = in == NULL ? NULL : fopen(filename, "w");
+    bool ok = out != NULL;
+    char buf[65536];
+    size_t m;
+    while (ok && (m = fread(buf, 1, sizeof(buf), in)) > 0)
+        ok = fwrite(buf, 1, m, out) == m;
+    if (in != NULL)
+        fclose(in);
+    if (out != NULL && fclose(out) != 0)
+        ok = false;
+    if (!ok)
+        remove(filename);
+    return ok;
+}
+
+// DESCRIPTION: Stores filename, just received whole and checked against digest. Returns false if it could not be.
+bool storeAdd(const unsigned char *digest, const char *filename)
+{
+    char path[STORE_PATH];
+    storePath(path, digest);
+    if (mkdir(STORE_DIR, 0755) < 0 && errno != EEXIST)
+        return false;
+    return link(filename, path) == 0 || errno == EEXIST;
+}
+
+// =====================================
+// Delta Transfers: A client with --delta names its file in OPT_DELTA by an
+// id that stays the same from one version of it to the next. The last
+// version received under the id is kept as delta-<id>.base, a hard link to
+// the <fileNo>.file it came in as. When there is a base, the SYN-ACK carries
+// its signature in OPT_SIGs: the base is cut into as few blocks as the
+// SYN-ACK has room for, and each block's rolling sum and the start of its
+// SHA-256 sent. The client then sends records instead of the file, DELTA_LIT
+// with data of its own or DELTA_COPY with a run of the base's blocks, and the
+// file is rebuilt from them as they come in. Once the FIN is in and the file
+// has the size the client named, it becomes the base for the next version.
+
+#define DELTA_BLOCK_MIN 256 /* smallest block a base is cut into */
+#define DELTA_NAME 32       /* room for delta-<id>.base */
+#define SYN_OPTS_ROOM 96    /* room the SYN-ACK's other options may take next to the signature */
+
+struct deltaState
+{
+    bool named; /* the client named its file with --delta */
+    bool on;    /* and is sending records against the base */
+    bool kept;  /* the file has become the base since */
+    unsigned long long id;
+    long long size; /* the size the client named */
+    int fd;         /* the base, open since the signature was taken of it */
+    long long baseSize;
+    int block;
+    unsigned char hdr[DELTA_HDR];
+    int hdrLen;
+    long long litLeft; /* bytes of the literal being written still to come */
+    long long written; /* bytes of the file rebuilt */
+    long long copied;  /* of which from the base */
+};
+
+// DESCRIPTION: Writes the name of the base kept for id into name.
+void deltaName(char *name, unsigned long long id)
+{
+    snprintf(name, DELTA_NAME, "delta-%016llx.base", id);
+}
+
+// DESCRIPTION: Returns how many blocks' sums fit in a SYN-ACK of mss bytes.
+int deltaRoom(int mss)
+{
+    int room = mss - SYN_OPTS_ROOM - 2 - DELTA_ANSWER;
+    int full = 4 + SIG_PER_OPT * (4 + STRONG_SIZE);
+    int n = room / full * SIG_PER_OPT;
+    if (room % full > 4)
+        n += (room % full - 4) / (4 + STRONG_SIZE);
+    return n < SIG_MAX ? n : SIG_MAX;
+}
+
+// DESCRIPTION: Opens the base kept for d's id and puts its signature in terms, for a SYN-ACK of mss bytes. Without
+//              a base, terms is left without OPT_DELTA and the client sends the file as it is.
+void deltaSign(struct deltaState *d, struct synOpts *terms, int mss)
+{
+    char name[DELTA_NAME];
+    deltaName(name, d->id);
+    terms->deltaLen = -1;
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    int n = deltaRoom(mss);
+    long long block = (st.st_size + n - 1) / n;
+    d->on = true;
+    d->fd = fd;
+    d->baseSize = st.st_size;
+    d->block = block > DELTA_BLOCK_MIN ? block : DELTA_BLOCK_MIN;
+    terms->deltaLen = DELTA_ANSWER;
+    terms->deltaBlock = d->block;
+    terms->deltaSize = d->baseSize;
+    terms->deltaBlocks = (d->baseSize + d->block - 1) / d->block;
+
+    unsigned char *buf = malloc(d->block);
+    for (int j = 0; j < terms->deltaBlocks; j++)
+    {
+        ssize_t len = pread(fd, buf, d->block, (long long)j * d->block);
+        len = len > 0 ? len : 0;
+        terms->sigWeak[j] = deltaWeak(buf, len);
+        deltaStrong(buf, len, terms->sigStrong[j]);
+    }
+    free(buf);
+}
+
+// DESCRIPTION: Writes blocks blocks of the base, from block first on, to fp.
+void deltaCopy(struct deltaState *d, FILE *fp, long long first, long long blocks)
+{
+    char buf[65536];
+    long long at = first * d->block;
+    long long end = (first + blocks) * d->block < d->baseSize ? (first + blocks) * d->block : d->baseSize;
+    while (at < end)
+    {
+        ssize_t m = pread(d->fd, buf, end - at < (long long)sizeof(buf) ? end - at : (long long)sizeof(buf), at);
+        if (m <= 0)
+            return;
+        fwrite(buf, 1, m, fp);
+        at += m;
+        d->written += m;
+        d->copied += m;
+    }
+}
+
+// DESCRIPTION: Rebuilds the next part of the file in fp from len bytes of records.
+void deltaWrite(struct deltaState *d, FILE *fp, const char *data, int len)
+{
+    while (len > 0)
+    {
+        if (d->litLeft > 0)
+        {
+            int m = len < d->litLeft ? len : (int)d->litLeft;
+            fwrite(data, 1, m, fp);
+            data += m;
+            len -= m;
+            d->litLeft -= m;
+            d->written += m;
+            continue;
+        }
+        d->hdr[d->hdrLen++] = *data++;
+        len--;
+        if (d->hdrLen < (d->hdr[0] == DELTA_COPY ? DELTA_HDR : 5))
+            continue;
+        unsigned long long fields[2] = {0, 0};
+        for (int i = 1; i < d->hdrLen; i++)
+            fields[(i - 1) / 4] = (fields[(i - 1) / 4] << 8) | d->hdr[i];
+        if (d->hdr[0] == DELTA_COPY)
+            deltaCopy(d, fp, fields[0], fields[1]);
+        else
+            d->litLeft = fields[0];
+        d->hdrLen = 0;
+    }
+}
+
+// =====================================
+// Connections: The server takes up to MAX_CONNS clients at once, told apart
+// by their address. Each goes through what the single-client server did in
+// turn: SYN-ACK sent until the first data pkt arrives (CONN_SYN), the file
+// (CONN_DATA), and our FIN sent (CONN_FIN), at which point the teardown is
+// handed over to the TIME_WAIT table below and the slot is free again.
+// Nothing waits on one client: the main loop polls the socket, hands each pkt
+// to the connection it belongs to, and then runs the timers of all of them.
+
+#define CONN_FREE 0
+#define CONN_SYN 1
+#define CONN_DATA 2
+#define CONN_FIN 3
+
+struct conn
+{
+    int state;
+    int fileNo; /* the file is saved as <fileNo>.file */
+    struct sockaddr_in addr;
+    int addrlen;
+    FILE *fp;
+    unsigned short seqNum;
+    unsigned short cliSeqNum;
+    unsigned short expSeqNum; /* next byte expected in order, i.e. the cumulative ACK */
+    unsigned short synSeqNum; /* seqnum of the client's SYN */
+    int mss;                  /* payload of every data pkt but the last */
+    int wnd;                  /* pkts the client may have in flight */
+    int seqSpace;             /* seqnums past the handshake count modulo this */
+    int early;                /* bytes of file data taken with the SYN on a redeemed ticket */
+    struct packet synackpkt;
+    struct packet finpkt;
+    struct pktExt ext;
+    struct rxMeta rx; /* the pkt last received, which the next ACK answers */
+    struct timingStats stats;
+    struct fecState fec;
+    struct ftnDecoder ftn;
+    struct nakState nak;
+    struct pullState pull;
+    struct session sess;
+    bool striped;
+    long long stripeAt;   /* with a stripe, where in the file the next byte goes */
+    long long stripeSize; /* and the whole file's size */
+    bool resumable;
+    unsigned long long resumeId;
+    long long resumed;  /* with --resume, the offset the transfer picked up at */
+    long long resumeAt; /* how much of the file has been written so far */
+    long long ckptAt;   /* and how much of it the last checkpoint has */
+    bool hashed;        /* with --dedup, the client named the content */
+    bool deduped;       /* which was stored, so none of it is sent */
+    bool stored;        /* or which was sent and has been stored since */
+    unsigned char digest[DIGEST_SIZE];
+    long long hashSize;
+    struct sha256 hashing; /* of what has come in, to check against digest */
+    struct deltaState delta;
+
+    // The receive window takes pkts that start less than wnd segments past the next byte expected.
+    // Under GBN only the pkt holding that byte is taken and anything past a gap is dropped; under SR
+    // later pkts wait for the gap in any free slot. Segments need not all be mss long, so what a slot
+    // holds is told by its seqnum, not by its place.
+    struct packet pkts[WND_MAX];
+    bool rcvd[WND_MAX];
+};
+
+// DESCRIPTION: Returns the connection of the client at addr, or NULL.
+struct conn *connFind(struct conn *conns, struct sockaddr_in *addr)
+{
+    for (int i = 0; i < MAX_CONNS; i++)
+    {
+        if (conns[i].state != CONN_FREE && conns[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && conns[i].addr.sin_port == addr->sin_port)
+            return &conns[i];
+    }
+    return NULL;
+}
+
+// DESCRIPTION: Sends pkt to the connection's client, with the connection's trailer.
+void connSend(int sockfd, struct conn *c, struct packet *pkt)
+{
+    sendPkt(sockfd, pkt, &c->ext, &c->addr, c->addrlen);
+    c->pull.told = c->ext.credit;
+}
+
+// DESCRIPTION: Logs and sends ackpkt as the answer to the pkt last received.
+void connAck(int sockfd, struct conn *c, struct packet *ackpkt)
+{
+    printSend(ackpkt, 0);
+    stampAck(&c->ext, &c->rx, &c->stats);
+    connSend(sockfd, c, ackpkt);
+}
+
+// DESCRIPTION: Notes a pkt received from the connection's client: its timing, and the tsVal the next pkt echoes.
+void connOnRecv(struct conn *c, struct pktExt *rext, struct rxMeta *rx)
+{
+    if (rx->kernel)
+    {
+        c->stats.rxLagSum += rx->lag;
+        c->stats.rxs++;
+    }
+    c->ext.tsEcr = rext->tsVal;
+    c->rx = *rx;
+}
+
+// DESCRIPTION: NAKs each gap in front of a held pkt that no NAK covers yet, and repeats the NAK for any part of a
+//              gap whose last NAK went unanswered.
+void connNakGaps(int sockfd, struct conn *c)
+{
+    struct nakState *k = &c->nak;
+    int at = 0; /* offset from expSeqNum of the first byte not known to be held */
+    while (1)
+    {
+        int next = -1;
+        int nextOff = 0;
+        for (int j = 0; j < WND_MAX; j++)
+        {
+            int off = c->rcvd[j] ? seqOffset(c->pkts[j].seqnum, c->expSeqNum, c->seqSpace) : -1;
+            if (off >= at && (next < 0 || off < nextOff))
+            {
+                next = j;
+                nextOff = off;
+            }
+        }
+        if (next < 0)
+            return;
+
+        // A gap is first NAKed as a whole; pkts that arrive later may split it, and the parts still missing
+        // share the range's tries.
+        while (at < nextOff)
+        {
+            struct nakRange *r = nakFind(k, c->expSeqNum, at);
+            int end = r == NULL ? nextOff : seqOffset(r->start, c->expSeqNum, c->seqSpace) + r->len;
+            if (end > nextOff)
+                end = nextOff;
+            if (r == NULL)
+            {
+                r = nakAlloc(k, c->expSeqNum);
+                r->start = (c->expSeqNum + at) % c->seqSpace;
+                r->len = end - at;
+            }
+            if (r->tries == 0 || (r->tries < NAK_TRIES && getTime() - r->at >= k->retry))
+                nakSend(sockfd, k, c->seqNum, r, (c->expSeqNum + at) % c->seqSpace, end - at, &c->ext, &c->addr, c->addrlen);
+            at = end;
+        }
+        at = nextOff + c->pkts[next].length;
+    }
+}
+
+// DESCRIPTION: Hands out credits while fewer than PULL_BUDGET granted pkts are outstanding over every connection,
+//              one at a time to the connection with the fewest outstanding, up to its window each.
+void pullAllot(struct conn *conns)
+{
+    double now = getTime();
+    int total = 0;
+    for (int i = 0; i < MAX_CONNS; i++)
+    {
+        struct conn *c = &conns[i];
+        if (c->state == CONN_DATA && c->pull.on && now - c->pull.lastArrival < (double)PULL_IDLE / 1000000)
+            total += (int)(c->ext.credit - c->pull.arrived);
+    }
+    while (total < PULL_BUDGET)
+    {
+        struct conn *best = NULL;
+        int bestOut = 0;
+        for (int i = 0; i < MAX_CONNS; i++)
+        {
+            struct conn *c = &conns[i];
+            int out = (int)(c->ext.credit - c->pull.arrived);
+            if (c->state == CONN_DATA && c->pull.on && out < c->wnd && (best == NULL || out < bestOut))
+            {
+                best = c;
+                bestOut = out;
+            }
+        }
+        if (best == NULL)
+            break;
+        best->ext.credit++;
+        total++;
+    }
+}
+
+// DESCRIPTION: Counts a new pkt taken from the connection's client and passes its credit on.
+// ANALYSIS: Called before the pkt is acked, so the ACK usually carries the credit the pkt freed.
+void pullOnArrival(struct conn *conns, struct conn *c)
+{
+    if (!c->pull.on)
+        return;
+    c->pull.arrived++;
+    c->pull.lastArrival = getTime();
+    pullAllot(conns);
+}
+
+// DESCRIPTION: Sends a grant pkt to each connection whose credit grew since the last pkt it was sent, and again to
+//              each that has credit left but has been silent for an RTO, in case the last one was lost.
+void pullTell(int sockfd, struct conn *conns)
+{
+    double now = getTime();
+    for (int i = 0; i < MAX_CONNS; i++)
+    {
+        struct conn *c = &conns[i];
+        if (c->state != CONN_DATA || !c->pull.on)
+            continue;
+        bool silent = now - c->pull.lastArrival >= (double)RTO / 1000000 && now - c->pull.grantAt >= (double)RTO / 1000000;
+        if (c->ext.credit == c->pull.told && !(silent && c->ext.credit != c->pull.arrived))
+            continue;
+        struct packet grantpkt;
+        buildPkt(&grantpkt, c->seqNum, c->expSeqNum, 0, 0, 0, 0, 0, NULL);
+        printSend(&grantpkt, 0);
+        c->ext.flags |= EXT_GNT;
+        connSend(sockfd, c, &grantpkt);
+        c->ext.flags &= ~EXT_GNT;
+        c->pull.grantAt = now;
+        c->pull.grants++;
+    }
+}
+
+// DESCRIPTION: Creates <fileNo>.file for the connection, or for a session the <fileNo>.session directory its files go
+//              into as their headers come in. Any file left under the number is removed rather than written over.
+void connOpenFile(struct conn *c)
+{
+    // Stored content was put in place with the SYN-ACK.
+    if (c->deduped)
+    {
+        c->fp = NULL;
+        return;
+    }
+    if (c->sess.on)
+    {
+        char dirname[32];
+        snprintf(dirname, sizeof(dirname), "%d.session", c->fileNo);
+        if (mkdir(dirname, 0755) < 0 && errno != EEXIST)
+        {
+            perror("ERROR: Directory could not be created\n");
+            exit(1);
+        }
+        c->fp = NULL;
+        return;
+    }
+
+    int length = snprintf(NULL, 0, "%d", c->fileNo) + 6;
+    char *filename = malloc(length);
+    snprintf(filename, length, "%d.file", c->fileNo);
+
+    // Stripes share the file, so none of them may truncate what another has written; each sizes it to the whole.
+    if (c->striped)
+    {
+        int fd = open(filename, O_WRONLY | O_CREAT, 0644);
+        c->fp = fd < 0 || ftruncate(fd, c->stripeSize) < 0 ? NULL : fdopen(fd, "w");
+    }
+    // A resumed transfer keeps what the checkpoint has and writes over whatever came after it.
+    else if (c->resumable)
+    {
+        char part[RESUME_NAME];
+        resumeName(part, c->resumeId, "part");
+        int fd = open(part, O_WRONLY | O_CREAT, 0644);
+        c->fp = fd < 0 || ftruncate(fd, c->resumed) < 0 || lseek(fd, c->resumed, SEEK_SET) < 0 ? NULL : fdopen(fd, "w");
+    }
+    else
+    {
+        remove(filename);
+        c->fp = fopen(filename, "w");
+    }
+    free(filename);
+    if (c->fp == NULL)
+    {
+        perror("ERROR: File could not be created\n");
+        exit(1);
+    }
+}
+
+// DESCRIPTION: Creates the file whose header has just come in on stream t. One that is empty is done with at once.
+void connBeginFile(struct conn *c, struct sessStream *t)
+{
+    int nameLen = t->nameLen < SESS_NAME_MAX ? t->nameLen : SESS_NAME_MAX;
+    char name[SESS_NAME_MAX + 1];
+    for (int i = 0; i < nameLen; i++)
+        name[i] = t->hdr[SESS_HDR + i] == '/' || t->hdr[SESS_HDR + i] == '\0' ? '_' : t->hdr[SESS_HDR + i];
+    name[nameLen] = '\0';
+    if (name[0] == '.')
+        name[0] = '_';
+    c->sess.files++;
+    if (nameLen == 0)
+        snprintf(name, sizeof(name), "%d.file", c->sess.files);
+    t->left = 0;
+    for (int i = 2; i < SESS_HDR; i++)
+        t->left = (t->left << 8) | t->hdr[i];
+    t->hdrLen = 0;
+
+    char path[SESS_NAME_MAX + 32];
+    snprintf(path, sizeof(path), "%d.session/%s", c->fileNo, name);
+    t->fp = fopen(path, "w");
+    if (t->fp == NULL)
+    {
+        perror("ERROR: File could not be created\n");
+        exit(1);
+    }
+    if (t->left == 0)
+    {
+        fclose(t->fp);
+        t->fp = NULL;
+    }
+}
+
+// DESCRIPTION: Writes the next len bytes of stream t out, split up by the headers in it.
+void connStreamWrite(struct conn *c, struct sessStream *t, const char *data, int len)
+{
+    while (len > 0)
+    {
+        if (t->fp != NULL)
+        {
+            int m = len < t->left ? len : (int)t->left;
+            fwrite(data, 1, m, t->fp);
+            data += m;
+            len -= m;
+            t->left -= m;
+            if (t->left == 0)
+            {
+                fclose(t->fp);
+                t->fp = NULL;
+            }
+            continue;
+        }
+        if (t->hdrLen < (int)sizeof(t->hdr))
+            t->hdr[t->hdrLen] = *data;
+        t->hdrLen++;
+        data++;
+        len--;
+        if (t->hdrLen == SESS_HDR)
+            t->nameLen = (t->hdr[0] << 8) | t->hdr[1];
+        if (t->hdrLen == SESS_HDR + t->nameLen)
+            connBeginFile(c, t);
+    }
+}
+
+// DESCRIPTION: Writes the next len bytes of the client's stream out: to its file or, in a session, to the streams
+//              its frames belong to.
+void connWrite(struct conn *c, const char *data, int len)
+{
+    struct session *s = &c->sess;
+    if (c->deduped)
+        return;
+    if (c->striped)
+    {
+        if (pwrite(fileno(c->fp), data, len, c->stripeAt) == len)
+            c->stripeAt += len;
+        return;
+    }
+    if (!s->on)
+    {
+        if (c->delta.on)
+            deltaWrite(&c->delta, c->fp, data, len);
+        else
+            fwrite(data, 1, len, c->fp);
+        if (c->hashed)
+            sha256Update(&c->hashing, data, len);
+        c->resumeAt += len;
+        if (c->resumable && c->resumeAt - c->ckptAt >= CKPT_EVERY)
+        {
+            resumeSave(c->resumeId, c->fp, c->resumeAt);
+            c->ckptAt = c->resumeAt;
+        }
+        return;
+    }
+    if (!s->mux)
+    {
+        s->streams = 1;
+        connStreamWrite(c, &s->ss[0], data, len);
+        return;
+    }
+    while (len > 0)
+    {
+        if (s->frameLeft > 0)
+        {
+            int m = len < s->frameLeft ? len : s->frameLeft;
+            if (s->frameStream < MUX_MAX)
+                connStreamWrite(c, &s->ss[s->frameStream], data, m);
+            data += m;
+            len -= m;
+            s->frameLeft -= m;
+            continue;
+        }
+        s->frame[s->frameHdrLen++] = *data++;
+        len--;
+        if (s->frameHdrLen == MUX_HDR)
+        {
+            s->frameStream = (s->frame[0] << 8) | s->frame[1];
+            s->frameLeft = (s->frame[2] << 8) | s->frame[3];
+            s->frameHdrLen = 0;
+            if (s->frameStream < MUX_MAX && s->frameStream >= s->streams)
+                s->streams = s->frameStream + 1;
+        }
+    }
+}
+
+// DESCRIPTION: Closes whatever the connection is writing to, the file or, in a session, any file a stream was
+//              still in the middle of. A resumable transfer is whole by now, so its part becomes <fileNo>.file, and
+//              content named with --dedup is stored if it is what it was named, and a file named with --delta is
+//              kept as the base for its next version.
+void connCloseFiles(struct conn *c)
+{
+    if (c->fp != NULL)
+        fclose(c->fp);
+    c->fp = NULL;
+    char filename[32];
+    snprintf(filename, sizeof(filename), "%d.file", c->fileNo);
+    if (c->resumable)
+    {
+        char part[RESUME_NAME], ckpt[RESUME_NAME];
+        resumeName(part, c->resumeId, "part");
+        resumeName(ckpt, c->resumeId, "ckpt");
+        rename(part, filename);
+        remove(ckpt);
+    }
+    // A resumed transfer only hashed what came in this time.
+    if (c->hashed && !c->deduped && c->resumed == 0)
+    {
+        unsigned char digest[DIGEST_SIZE];
+        long long len = c->hashing.len;
+        sha256Final(&c->hashing, digest);
+        c->stored = len == c->hashSize && memcmp(digest, c->digest, DIGEST_SIZE) == 0 && storeAdd(c->digest, filename);
+    }
+    // A file of the size the client named is the base for its next version. The old base is still open if it
+    // was used, and is only let go of here.
+    if (c->delta.on)
+        close(c->delta.fd);
+    struct stat st;
+    if (c->delta.named && stat(filename, &st) == 0 && st.st_size == c->delta.size)
+    {
+        char base[DELTA_NAME];
+        deltaName(base, c->delta.id);
+        remove(base);
+        c->delta.kept = link(filename, base) == 0;
+    }
+    for (int i = 0; i < MUX_MAX; i++)
+    {
+        if (c->sess.ss[i].fp != NULL)
+            fclose(c->sess.ss[i].fp);
+        c->sess.ss[i].fp = NULL;
+    }
+}
+
+// DESCRIPTION: Drops any connection still open on transfer id, which its client has given up on and started over,
+//              checkpointing all it got first so that the new connection resumes from there.
+void connsTakeOver(struct conn *conns, unsigned long long id)
+{
+    for (int i = 0; i < MAX_CONNS; i++)
+    {
+        struct conn *o = &conns[i];
+        if ((o->state != CONN_SYN && o->state != CONN_DATA) || !o->resumable || o->resumeId != id)
+            continue;
+        if (o->fp != NULL)
+        {
+            resumeSave(id, o->fp, o->resumeAt);
+            fclose(o->fp);
+        }
+        o->fp = NULL;
+        o->state = CONN_FREE;
+    }
+}
+
+// DESCRIPTION: Returns in terms what we agree to of offer, every field set: the features, window, segment and seq
+//              space.
+void synAgree(struct synOpts *offer, struct synOpts *terms)
+{
+    // Fountain symbols are never acked, so there is nothing to hand out credit against.
+    // Parity and fountain blocks are PAYLOAD_SIZE apart, so they keep the segment at that.
+    memset(terms, 0, sizeof(*terms));
+    terms->ticketLen = -1;
+    terms->session = offer->session;
+    terms->mux = offer->session && offer->mux;
+    terms->stripeLen = offer->stripeLen == STRIPE_SIZE && !offer->session ? STRIPE_SIZE : -1;
+    terms->resumeLen = offer->resumeLen == RESUME_SIZE && !offer->session && terms->stripeLen < 0 && offer->early == 0 ? RESUME_SIZE : -1;
+    terms->hashLen = offer->hashLen == HASH_SIZE && !offer->session && terms->stripeLen < 0 && offer->early == 0 ? HASH_SIZE : -1;
+    terms->deltaLen = offer->deltaLen == DELTA_SIZE && !offer->session && terms->stripeLen < 0 && offer->early == 0 && terms->resumeLen < 0 && terms->hashLen < 0 ? DELTA_SIZE : -1;
+    terms->features = offer->features & (EXT_TS | EXT_ECN | EXT_SR | EXT_FEC | EXT_FTN | EXT_NAK | EXT_PULL | EXT_MSS);
+    if (terms->features & EXT_FTN)
+        terms->features &= ~EXT_PULL;
+    if ((terms->features & (EXT_FEC | EXT_FTN)) || offer->mss <= PAYLOAD_SIZE)
+        terms->features &= ~EXT_MSS;
+    terms->mss = PAYLOAD_SIZE;
+    if (terms->features & EXT_MSS)
+        terms->mss = offer->mss < MSS_MAX ? offer->mss : MSS_MAX;
+
+    // A window of segments must fit in half the seq space, or a resent pkt could pass for a new one.
+    terms->seqSpace = offer->seqSpace < MAX_SEQN ? MAX_SEQN : offer->seqSpace > SEQ_MAX ? SEQ_MAX : offer->seqSpace;
+    terms->wnd = offer->wnd < 1 ? WND_SIZE : offer->wnd > WND_MAX ? WND_MAX : offer->wnd;
+    while (2 * terms->wnd * terms->mss > terms->seqSpace)
+        terms->wnd--;
+}
+
+// DESCRIPTION: Writes the SYN-ACK's options, the answer to offer on terms, into buf, with a new ticket if the client
+//              asked for one. Returns their length.
+// ANALYSIS: Only what was offered is answered, so the spec's client gets the spec's empty SYN-ACK.
+int synAnswer(char *buf, struct synOpts *offer, struct synOpts *terms, struct tickets *tk, struct sockaddr_in *addr)
+{
+    struct synOpts agreed = *terms;
+    agreed.mss = (terms->features & EXT_MSS) ? terms->mss : 0;
+    agreed.wnd = offer->wnd > 0 ? terms->wnd : 0;
+    agreed.seqSpace = offer->seqSpace > 0 ? terms->seqSpace : 0;
+    agreed.stripeLen = terms->stripeLen == STRIPE_SIZE ? 0 : -1;
+    agreed.hashLen = terms->hashLen == HASH_SIZE ? 1 : -1;
+    agreed.deltaLen = terms->deltaLen == DELTA_ANSWER ? DELTA_ANSWER : -1;
+    if (offer->ticketLen >= 0)
+    {
+        agreed.ticketLen = TICKET_SIZE;
+        ticketIssue(tk, addr, agreed.ticket);
+    }
+    return optsWrite(buf, &agreed);
+}
+
+// DESCRIPTION: Sets the connection up on the agreed terms.
+void connAgree(struct conn *c, struct synOpts *terms)
+{
+    c->ext.flags = terms->features;
+    c->mss = terms->mss;
+    c->seqSpace = terms->seqSpace;
+    c->wnd = terms->wnd;
+    c->fec.on = c->ext.flags & EXT_FEC;
+    c->fec.seqSpace = c->seqSpace;
+    nakInit(&c->nak, c->ext.flags & EXT_NAK, c->seqSpace);
+    c->pull.on = c->ext.flags & EXT_PULL;
+    if (c->pull.on)
+        c->ext.credit = PULL_UNSCHED;
+    c->sess.on = terms->session;
+    c->sess.mux = terms->mux;
+}
+
+// DESCRIPTION: Sets the TOS byte on the socket, which all clients share: data goes out ECT while any of them has
+//              agreed to ECN.
+void connsEcn(int sockfd, struct conn *conns)
+{
+    bool ecn = false;
+    for (int i = 0; i < MAX_CONNS; i++)
+        ecn = ecn || (conns[i].state != CONN_FREE && (conns[i].ext.flags & EXT_ECN));
+    enableEcn(sockfd, ecn);
+}
+
+// DESCRIPTION: Returns a free slot, or NULL if every one is taken.
+struct conn *connAlloc(struct conn *conns)
+{
+    for (int i = 0; i < MAX_CONNS; i++)
+    {
+        if (conns[i].state == CONN_FREE)
+            return &conns[i];
+    }
+    return NULL;
+}
+
+// DESCRIPTION: Takes a free slot for the client whose SYN this is and answers it with a SYN-ACK. Returns NULL if
+//              every slot is taken, in which case the client's SYN timer tries again, and with --syn-cookies,
+//              where the SYN-ACK carries a cookie instead and no slot is taken. A stripe of a transfer already
+//              under way gets the fileNo of its group rather than fileNo.
+struct conn *connOpen(int sockfd, struct conn *conns, struct packet *synpkt, struct pktExt *rext, struct rxMeta *rx, struct sockaddr_in *addr, int addrlen, unsigned short seqNum, int fileNo, struct tickets *tk, struct cookies *ck, struct stripeGroup *groups)
+{
+    // The SYN's options are the client's offer; answer with what we support of it.
+    struct synOpts offer, terms;
+    int synLen = synpkt->length < MSS_MAX ? synpkt->length : MSS_MAX;
+    optsRead(synpkt->payload, synLen, &offer);
+    bool early = offer.early > 0 && offer.ticketLen == TICKET_SIZE;
+    char opts[MSS_MAX];
+
+    // Stripes, resumed transfers, named content and deltas name themselves, which there is no room to bring
+    // back with a cookie, so they take their slot at once.
+    if (ck->on && !early && offer.stripeLen != STRIPE_SIZE && offer.resumeLen != RESUME_SIZE && offer.hashLen != HASH_SIZE && offer.deltaLen != DELTA_SIZE)
+    {
+        // Only the features come back with the cookie unless the tsEcr can bring the rest.
+        if (!(offer.features & EXT_TS))
+            offer.wnd = offer.mss = offer.seqSpace = 0;
+        synAgree(&offer, &terms);
+        unsigned int params = (terms.features & EXT_TS) ? cookieParams(terms.wnd, terms.mss, terms.seqSpace) : 0;
+        unsigned int features = terms.features | (terms.session ? COOKIE_SESSION : 0) | (terms.mux ? COOKIE_MUX : 0);
+        unsigned short cookie = cookieMake(ck, addr, synpkt->seqnum, features, params, (unsigned int)getTime() / COOKIE_SLOT);
+
+        struct packet synackpkt;
+        buildPkt(&synackpkt, cookie, (synpkt->seqnum + 1) % MAX_SEQN, 1, 0, 1, 0, synAnswer(opts, &offer, &terms, tk, addr), opts);
+        struct pktExt ext;
+        memset(&ext, 0, sizeof(ext));
+        ext.flags = terms.features;
+        ext.tsEcr = rext->tsVal;
+        if (ext.flags & EXT_PULL)
+            ext.credit = PULL_UNSCHED;
+        printSend(&synackpkt, 0);
+        sendPktTs(sockfd, &synackpkt, &ext, params, addr, addrlen);
+        return NULL;
+    }
+
+    struct conn *c = connAlloc(conns);
+    if (c == NULL)
+        return NULL;
+
+    memset(c, 0, sizeof(*c));
+    c->state = CONN_SYN;
+    c->fileNo = fileNo;
+    c->addr = *addr;
+    c->addrlen = addrlen;
+    c->seqNum = seqNum;
+    c->synSeqNum = synpkt->seqnum;
+    connOnRecv(c, rext, rx);
+
+    synAgree(&offer, &terms);
+    connAgree(c, &terms);
+    connsEcn(sockfd, conns);
+    if (terms.stripeLen == STRIPE_SIZE)
+    {
+        c->striped = true;
+        c->stripeAt = offer.stripeAt;
+        c->stripeSize = offer.stripeSize;
+        c->fileNo = stripeJoin(groups, addr, offer.stripeId, offer.stripes, fileNo);
+
+        // The group's first stripe clears the way, as connOpenFile does for a file of its own.
+        char filename[32];
+        snprintf(filename, sizeof(filename), "%d.file", fileNo);
+        if (c->fileNo == fileNo)
+            remove(filename);
+    }
+    // Stored content is in place before the SYN-ACK says so; there is then nothing to resume.
+    if (terms.hashLen == HASH_SIZE)
+    {
+        char filename[32];
+        snprintf(filename, sizeof(filename), "%d.file", fileNo);
+        c->hashed = true;
+        memcpy(c->digest, offer.hash, DIGEST_SIZE);
+        c->hashSize = offer.hashSize;
+        sha256Init(&c->hashing);
+        c->deduped = terms.stored = storeFetch(offer.hash, offer.hashSize, filename);
+        if (c->deduped)
+            terms.resumeLen = -1;
+    }
+    if (terms.deltaLen == DELTA_SIZE)
+    {
+        c->delta.named = true;
+        c->delta.id = offer.deltaId;
+        c->delta.size = offer.deltaSize;
+        deltaSign(&c->delta, &terms, terms.mss);
+    }
+    if (terms.resumeLen == RESUME_SIZE)
+    {
+        connsTakeOver(conns, offer.resume);
+        c->resumable = true;
+        c->resumeId = offer.resume;
+        c->resumed = c->resumeAt = c->ckptAt = resumeLoad(offer.resume);
+        terms.resume = c->resumed;
+    }
+    int optsLen = synAnswer(opts, &offer, &terms, tk, addr);
+
+    c->cliSeqNum = (synpkt->seqnum + 1) % MAX_SEQN;
+
+    // 0-RTT: on a redeemed ticket the SYN's data opens the file, and the pkts behind it are taken as data.
+    // Parity and fountain pkts are counted from the handshake's last step, so neither goes with it.
+    if (early && !(c->ext.flags & (EXT_FEC | EXT_FTN)) && ticketRedeem(tk, addr, offer.ticket))
+    {
+        connOpenFile(c);
+        connWrite(c, synpkt->payload + synLen - offer.early, offer.early);
+        c->ext.rxCount++;
+        c->early = offer.early;
+        c->seqNum = (seqNum + 1) % MAX_SEQN;
+        c->cliSeqNum = (c->cliSeqNum + offer.early) % c->seqSpace;
+        c->expSeqNum = c->cliSeqNum;
+        c->state = CONN_DATA;
+    }
+    buildPkt(&c->synackpkt, seqNum, c->cliSeqNum, 1, 0, 1, 0, optsLen, opts);
+    connAck(sockfd, c, &c->synackpkt);
+    return c;
+}
+
+// DESCRIPTION: Handles a pkt while the SYN-ACK is out. The first data pkt opens the file; a repeated SYN is
+//              answered with the SYN-ACK again, also once 0-RTT data has opened it.
+void connOnHandshake(int sockfd, struct conn *conns, struct conn *c, struct packet *pkt)
+{
+    if (pkt->seqnum == c->cliSeqNum && (pkt->ack || pkt->dupack) && pkt->acknum == (c->synackpkt.seqnum + 1) % MAX_SEQN)
+    {
+        connOpenFile(c);
+        connWrite(c, pkt->payload, pkt->length);
+        fecHold(&c->fec, pkt);
+        c->ext.rxCount++;
+
+        c->seqNum = pkt->acknum;
+        c->cliSeqNum = (pkt->seqnum + pkt->length) % c->seqSpace;
+        c->expSeqNum = c->cliSeqNum;
+        c->state = CONN_DATA;
+        pullOnArrival(conns, c);
+
+        struct packet ackpkt;
+        buildPkt(&ackpkt, c->seqNum, c->cliSeqNum, 0, 0, 1, 0, 0, NULL);
+        connAck(sockfd, c, &ackpkt);
+    }
+    else if (pkt->syn)
+    {
+        c->synackpkt.ack = 0;
+        c->synackpkt.dupack = 1;
+        connAck(sockfd, c, &c->synackpkt);
+    }
+}
+
+// DESCRIPTION: Sets up the connection a SYN cookie was made for, if pkt is the handshake's last step bringing it
+//              back, and takes pkt as that step. Returns NULL if it is not, or if every slot is taken, in which
+//              case the client's RTO sends it again.
+struct conn *connFromCookie(int sockfd, struct conn *conns, struct packet *pkt, struct pktExt *rext, struct rxMeta *rx, struct sockaddr_in *addr, int addrlen, int fileNo, struct cookies *ck)
+{
+    if (pkt->syn || pkt->fin || !(pkt->ack || pkt->dupack))
+        return NULL;
+    unsigned short cookie = (pkt->acknum + MAX_SEQN - 1) % MAX_SEQN;
+    unsigned short isn = (pkt->seqnum + MAX_SEQN - 1) % MAX_SEQN;
+
+    // The trailer's flags are the features agreed; with EXT_TS the tsEcr is the rest of the terms.
+    struct synOpts terms;
+    memset(&terms, 0, sizeof(terms));
+    terms.features = rext->flags & (EXT_CE - 1);
+    unsigned int params = (terms.features & EXT_TS) ? rext->tsEcr : 0;
+    unsigned int ways[3] = {0, COOKIE_SESSION, COOKIE_SESSION | COOKIE_MUX};
+    int way = 0;
+    while (way < 3 && !cookieCheck(ck, addr, isn, terms.features | ways[way], params, cookie))
+        way++;
+    if (way == 3)
+        return NULL;
+    terms.session = ways[way] & COOKIE_SESSION;
+    terms.mux = ways[way] & COOKIE_MUX;
+    terms.wnd = (params & 0x1f) + 1;
+    terms.mss = ((params >> 5) & 0x3ff) + PAYLOAD_SIZE;
+    terms.seqSpace = (params >> 15) + MAX_SEQN;
+    if (!(terms.features & EXT_TS))
+        terms.wnd = WND_SIZE;
+
+    struct conn *c = connAlloc(conns);
+    if (c == NULL)
+        return NULL;
+
+    memset(c, 0, sizeof(*c));
+    c->state = CONN_SYN;
+    c->fileNo = fileNo;
+    c->addr = *addr;
+    c->addrlen = addrlen;
+    c->seqNum = cookie;
+    c->synSeqNum = isn;
+    connOnRecv(c, rext, rx);
+    connAgree(c, &terms);
+    connsEcn(sockfd, conns);
+
+    // A late copy of the SYN gets the SYN-ACK again, without options: the client has had them.
+    c->cliSeqNum = (isn + 1) % MAX_SEQN;
+    buildPkt(&c->synackpkt, cookie, c->cliSeqNum, 1, 0, 1, 0, 0, NULL);
+    connOnHandshake(sockfd, conns, c, pkt);
+    return c;
+}
+
+// DESCRIPTION: Handles a pkt of the file, or one FEC queued as if it had arrived. A FIN closes the file and sends ours.
+void connOnData(int sockfd, struct conn *conns, struct conn *c, struct packet *recvpkt, struct pktExt *rext, bool queued, int mode)
+{
+    struct packet ackpkt;
+
+    if (!queued && !recvpkt->fin)
+        c->ext.rxCount++;
+
+    if (!queued && (rext->flags & EXT_PAR))
+    {
+        if (c->fec.on)
+            fecOnParity(&c->fec, recvpkt);
+        return;
+    }
+
+    // Fountain symbols are not acked one by one. Once the file is decoded, each symbol still
+    // arriving is answered with the ACK that covers the whole of it, until the FIN shows it got through.
+    if (!queued && (rext->flags & EXT_SYM) && (c->ext.flags & EXT_FTN))
+    {
+        ftnAdd(&c->ftn, recvpkt);
+        if (c->ftn.decoded < c->ftn.k)
+            return;
+        if (!c->ftn.written)
+        {
+            connWrite(c, c->ftn.blocks, c->ftn.length);
+            c->ftn.written = true;
+        }
+        buildPkt(&ackpkt, c->seqNum, (c->expSeqNum + c->ftn.length) % c->seqSpace, 0, 0, 1, 0, 0, NULL);
+        connAck(sockfd, c, &ackpkt);
+        return;
+    }
+
+    if (recvpkt->fin)
+    {
+        c->cliSeqNum = (recvpkt->seqnum + recvpkt->length + 1) % c->seqSpace;
+        buildPkt(&ackpkt, c->seqNum, c->cliSeqNum, 0, 0, 1, 0, 0, NULL);
+        connAck(sockfd, c, &ackpkt);
+
+        connCloseFiles(c);
+        buildPkt(&c->finpkt, c->seqNum, 0, 0, 1, 0, 0, 0, NULL);
+        printSend(&c->finpkt, 0);
+        connSend(sockfd, c, &c->finpkt);
+        c->state = CONN_FIN;
+        return;
+    }
+
+    // A client that agreed to EXT_SR says per pkt which mode it is in; others get our default.
+    bool sel = (c->ext.flags & EXT_SR) ? (rext->flags & EXT_SEL) != 0 : mode == MODE_SR;
+    bool naks = c->nak.on && sel;
+    if (c->ext.flags & EXT_SR)
+    {
+        c->ext.flags &= ~EXT_SEL;
+        if (sel && !naks)
+            c->ext.flags |= EXT_SEL;
+    }
+
+    int off = seqOffset(recvpkt->seqnum, c->expSeqNum, c->seqSpace);
+
+    // Data we already hold is answered with a DUP-ACK, which tells the client that this copy
+    // (or an earlier one) was redundant and lets it undo a spurious timeout.
+    bool isDup = off < 0 || off >= c->wnd * c->mss || getRcvdPktIdx(c->rcvd, c->pkts, recvpkt->seqnum) >= 0;
+    if (queued && isDup)
+        return;
+    fecHold(&c->fec, recvpkt);
+
+    // Under --nak, a pkt past a gap NAKs what is missing before it, and a NAKed pkt or one
+    // that fills a gap is acked at once so the sender sees the window move.
+    bool ackNow = isDup;
+    bool inOrder = off == 0;
+    if (naks && !isDup && nakOnArrival(&c->nak, c->expSeqNum, recvpkt->seqnum))
+        ackNow = true;
+
+    int idx = !isDup && (sel || inOrder) ? getFreeIdx(c->rcvd) : -1;
+    if (idx >= 0)
+    {
+        c->pkts[idx] = *recvpkt;
+        c->rcvd[idx] = true;
+        // Write out the run of held pkts that now follows on from the next byte expected.
+        int written = 0;
+        while ((idx = getRcvdPktIdx(c->rcvd, c->pkts, c->expSeqNum)) >= 0)
+        {
+            connWrite(c, c->pkts[idx].payload, c->pkts[idx].length);
+            c->expSeqNum = (c->pkts[idx].seqnum + c->pkts[idx].length) % c->seqSpace;
+            c->rcvd[idx] = false;
+            written++;
+        }
+        if (written > 1)
+            ackNow = true;
+        pullOnArrival(conns, c);
+    }
+    if (naks && !isDup)
+        connNakGaps(sockfd, c);
+
+    if (naks && !ackNow)
+    {
+        // Out of order: the NAKs said all there is to say. In order: wait for company.
+        if (inOrder && ++c->nak.pending >= NAK_ACK_EVERY)
+            ackNow = true;
+        else if (inOrder && c->nak.ackAt == 0)
+            c->nak.ackAt = getTime() + (double)NAK_ACK_DELAY / 1000000;
+    }
+
+    if (!naks || ackNow)
+    {
+        if (sel && !naks)
+            c->stats.sels++;
+        unsigned short ackNum = sel && !naks ? (recvpkt->seqnum + recvpkt->length) % c->seqSpace : c->expSeqNum;
+        buildPkt(&ackpkt, c->seqNum, ackNum, 0, 0, !isDup, isDup, 0, NULL); // DOUBLE CHECK seqNum
+        connAck(sockfd, c, &ackpkt);
+        c->nak.pending = 0;
+        c->nak.ackAt = 0;
+    }
+
+    if (c->fec.on)
+    {
+        fecPoll(&c->fec);
+        // GBN dropped whatever was past the gap; what is held of it can go through now.
+        struct packet *next = fecFind(&c->fec, c->expSeqNum);
+        if (!sel && next != NULL && c->fec.outN == 0)
+            fecQueue(&c->fec, next);
+    }
+}
+
+// DESCRIPTION: Runs the connection's timers under --nak: the delayed ACK and the repeats of unanswered NAKs.
+void connOnTimer(int sockfd, struct conn *c)
+{
+    if (c->state != CONN_DATA || !c->nak.on)
+        return;
+
+    if (c->nak.ackAt != 0 && isTimeout(c->nak.ackAt))
+    {
+        struct packet ackpkt;
+        buildPkt(&ackpkt, c->seqNum, c->expSeqNum, 0, 0, 1, 0, 0, NULL);
+        connAck(sockfd, c, &ackpkt);
+        c->nak.pending = 0;
+        c->nak.ackAt = 0;
+    }
+    // Repeat NAKs that went unanswered. Only gaps in front of a held pkt are NAKed, so this never reaches
+    // past the last pkt received.
+    connNakGaps(sockfd, c);
+}
+
+// DESCRIPTION: Prints the connection's stats with --stats and frees its slot.
+void connClose(struct conn *c, bool showStats)
+{
+    int i = c->fileNo;
+    if (showStats && c->stats.acks > 0)
+        fprintf(stderr, "STATS %d.file hold avg %.3f ms, max %.3f ms over %d ACKs\n", i, c->stats.holdSum / c->stats.acks * 1000, c->stats.holdMax * 1000, c->stats.acks);
+    if (showStats && c->stats.rxs > 0)
+        fprintf(stderr, "STATS %d.file rx lag (kernel to userspace) avg %.3f ms over %d pkts\n", i, c->stats.rxLagSum / c->stats.rxs * 1000, c->stats.rxs);
+    if (showStats && (c->ext.flags & EXT_ECN))
+        fprintf(stderr, "STATS %d.file ecn %d CE-marked pkts\n", i, c->stats.ces);
+    if (showStats)
+        fprintf(stderr, "STATS %d.file %d of %d ACKs selective\n", i, c->stats.sels, c->stats.acks);
+    if (showStats && c->fec.on)
+        fprintf(stderr, "STATS %d.file fec rebuilt %d pkts from %d parity pkts\n", i, c->fec.rebuilt, c->fec.parities);
+    if (showStats && c->nak.on)
+        fprintf(stderr, "STATS %d.file nak %d NAKs sent, retry %.3f ms\n", i, c->nak.sent, c->nak.retry * 1000);
+    if (showStats && c->ftn.on)
+        fprintf(stderr, "STATS %d.file fountain decoded %d blocks from %d of %d symbols\n", i, c->ftn.decoded, c->ftn.needed, c->ftn.received);
+    if (showStats && (c->ext.flags & EXT_MSS))
+        fprintf(stderr, "STATS %d.file mss %d\n", i, c->mss);
+    if (showStats && c->early > 0)
+        fprintf(stderr, "STATS %d.file 0-rtt %d bytes with the SYN\n", i, c->early);
+    if (showStats && c->sess.on && !c->sess.mux)
+        fprintf(stderr, "STATS %d.session %d files\n", i, c->sess.files);
+    if (showStats && c->sess.mux)
+        fprintf(stderr, "STATS %d.session %d files over %d streams\n", i, c->sess.files, c->sess.streams);
+    if (showStats && c->striped)
+        fprintf(stderr, "STATS %d.file stripe ending at %lld of %lld bytes\n", i, c->stripeAt, c->stripeSize);
+    if (showStats && c->resumable)
+        fprintf(stderr, "STATS %d.file resumed at %lld bytes, %lld more received\n", i, c->resumed, c->resumeAt - c->resumed);
+    if (showStats && c->deduped)
+        fprintf(stderr, "STATS %d.file dedup %lld bytes stored already, none sent\n", i, c->hashSize);
+    else if (showStats && c->hashed)
+        fprintf(stderr, "STATS %d.file dedup %lld bytes %s\n", i, c->hashSize, c->stored ? "stored" : "not stored");
+    if (showStats && c->delta.on)
+        fprintf(stderr, "STATS %d.file delta rebuilt %lld bytes, %lld of them from the base\n", i, c->delta.written, c->delta.copied);
+    if (showStats && c->delta.named)
+        fprintf(stderr, "STATS %d.file delta %s as the base\n", i, c->delta.kept ? "kept" : "not kept");
+    if (showStats && c->pull.on)
+        fprintf(stderr, "STATS %d.file pull %u credits for %u pkts, %d grant pkts\n", i, c->ext.credit, c->pull.arrived, c->pull.grants);
+    ftnFree(&c->ftn);
+    c->state = CONN_FREE;
+}
+
+// =====================================
+// TIME_WAIT: Once the client's FIN is acked and ours is out, all a
+// connection still needs is its address, our FIN and the trailer to send it
+// with. Those go into a table of their own and the connection's slot is freed
+// at once, so a slow or lost final ACK never keeps the next client waiting.
+// Our FIN is resent until it is acked, but at most TW_TRIES times, since the
+// client may have finished its FIN_WAIT and gone. A SYN from the same address
+// ends the entry and opens a new connection.
+
+#define TW_MAX 64  /* connections tearing down at once; the oldest makes way when the table is full */
+#define TW_TRIES 8 /* FIN resends before the client is taken to have gone */
+
+struct timeWait
+{
+    bool used;
+    struct sockaddr_in addr;
+    int addrlen;
+    struct packet finpkt;
+    unsigned short cliSeqNum; /* what a repeated FIN of the client's is acked with */
+    int seqSpace;
+    struct pktExt ext; /* the agreed trailer flags, none of the per-pkt signals */
+    double since;      /* when the entry was taken */
+    double timer;      /* FIN resend */
+    int tries;
+};
+
+// DESCRIPTION: Returns the TIME_WAIT entry of the client at addr, or NULL.
+struct timeWait *timeWaitFind(struct timeWait *tws, struct sockaddr_in *addr)
+{
+    for (int i = 0; i < TW_MAX; i++)
+    {
+        if (tws[i].used && tws[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr && tws[i].addr.sin_port == addr->sin_port)
+            return &tws[i];
+    }
+    return NULL;
+}
+
+// DESCRIPTION: Hands the teardown of a connection whose FIN is out over to a free entry, or else to the oldest.
+void timeWaitAdd(struct timeWait *tws, struct conn *c)
+{
+    struct timeWait *tw = NULL;
+    for (int i = 0; i < TW_MAX && (tw == NULL || tw->used); i++)
+    {
+        if (tw == NULL || !tws[i].used || tws[i].since < tw->since)
+            tw = &tws[i];
+    }
+    tw->used = true;
+    tw->addr = c->addr;
+    tw->addrlen = c->addrlen;
+    tw->finpkt = c->finpkt;
+    tw->cliSeqNum = c->cliSeqNum;
+    tw->seqSpace = c->seqSpace;
+    tw->ext = c->ext;
+    tw->ext.flags &= EXT_CE - 1;
+    tw->since = getTime();
+    tw->timer = setTimer();
+    tw->tries = 0;
+}
+
+// DESCRIPTION: Handles a pkt for a TIME_WAIT entry: a repeated FIN is acked again along with ours, the ACK of ours
+//              frees the entry.
+void timeWaitOnRecv(int sockfd, struct timeWait *tw, struct packet *pkt, struct pktExt *rext)
+{
+    tw->ext.tsEcr = rext->tsVal;
+    if (pkt->fin)
+    {
+        struct packet ackpkt;
+        buildPkt(&ackpkt, tw->finpkt.seqnum, tw->cliSeqNum, 0, 0, 0, 1, 0, NULL);
+        printSend(&ackpkt, 0);
+        sendPkt(sockfd, &ackpkt, &tw->ext, &tw->addr, tw->addrlen);
+
+        printSend(&tw->finpkt, 1);
+        sendPkt(sockfd, &tw->finpkt, &tw->ext, &tw->addr, tw->addrlen);
+        tw->timer = setTimer();
+    }
+    else if ((pkt->ack || pkt->dupack) && pkt->acknum == (tw->finpkt.seqnum + 1) % tw->seqSpace)
+        tw->used = false;
+}
+
+// DESCRIPTION: Resends the entry's FIN if its timer ran out, or frees the entry once it has been resent TW_TRIES times.
+void timeWaitOnTimer(int sockfd, struct timeWait *tw)
+{
+    if (!tw->used || !isTimeout(tw->timer))
+        return;
+    if (tw->tries++ == TW_TRIES)
+    {
+        tw->used = false;
+        return;
+    }
+    printTimeout(&tw->finpkt);
+    printSend(&tw->finpkt, 1);
+    sendPkt(sockfd, &tw->finpkt, &tw->ext, &tw->addr, tw->addrlen);
+    tw->timer = setTimer();
+}
+
+int main(int argc, char *argv[])
+{
+    // =====================================
+    // Options
+
+    bool kernelTs = false;
+    bool showStats = false;
+    bool synCookies = false;
+    int mode = DEFAULT_MODE;
+
+    struct option longOpts[] = {
+        {"kernel-ts", no_argument, NULL, 'k'},
+        {"stats", no_argument, NULL, 'S'},
+        {"mode", required_argument, NULL, 'm'},
+        {"syn-cookies", no_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOpts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            kernelTs = true;
+            break;
+        case 'S':
+            showStats = true;
+            break;
+        case 'c':
+            synCookies = true;
+            break;
+        case 'm':
+            if (strcmp(optarg, "gbn") == 0)
+                mode = MODE_GBN;
+            else if (strcmp(optarg, "sr") == 0)
+                mode = MODE_SR;
+            else
+            {
+                fprintf(stderr, "ERROR: unknown mode %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [--kernel-ts] [--stats] [--mode gbn|sr] [--syn-cookies] <port>\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        perror("ERROR: incorrect number of arguments\n");
+        exit(1);
+    }
+    argv += optind - 1;
+
+    unsigned int servPort = atoi(argv[1]);
+
+    // =====================================
+    // Socket Setup
+
+    int sockfd;
+    struct sockaddr_in servaddr, cliaddr;
+
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servaddr.sin_port = htons(servPort);
+    memset(servaddr.sin_zero, '\0', sizeof(servaddr.sin_zero));
+
+    if (bind(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) == -1)
+    {
+        perror("bind() error");
+        exit(1);
+    }
+
+    int cliaddrlen = sizeof(cliaddr);
+
+    // NOTE: We set the socket as non-blocking so that we can poll it until
+    //       timeout instead of getting stuck. This way is not particularly
+    //       efficient in real programs but considered acceptable in this
+    //       project.
+    //       Optionally, you could also consider adding a timeout to the socket
+    //       using setsockopt with SO_RCVTIMEO instead.
+    fcntl(sockfd, F_SETFL, O_NONBLOCK);
+
+    if (kernelTs && enableKernelTs(sockfd, false) < 0)
+    {
+        perror("WARNING: SO_TIMESTAMPING unavailable, using userspace times");
+        kernelTs = false;
+    }
+
+    enableEcn(sockfd, false);
+
+    // =====================================
+
+    unsigned short seqNum = (rand() * rand()) % MAX_SEQN;
+    struct conn *conns = calloc(MAX_CONNS, sizeof(struct conn));
+    struct timeWait *tws = calloc(TW_MAX, sizeof(struct timeWait));
+    int fileNo = 1;
+    struct tickets tickets;
+    ticketsInit(&tickets);
+    struct cookies cookies = {synCookies, drawKey()};
+    struct stripeGroup *groups = calloc(STRIPE_GROUPS, sizeof(struct stripeGroup));
+
+    while (1)
+    {
+        int n;
+        struct packet recvpkt;
+        struct pktExt rext;
+        struct rxMeta rx;
+
+        cliaddrlen = sizeof(cliaddr);
+        n = recvPkt(sockfd, &recvpkt, &rext, &rx, &cliaddr, &cliaddrlen);
+
+        if (n > 0)
+        {
+            if (!(rext.flags & EXT_PAR))
+                printRecv(&recvpkt);
+
+            // =====================================
+            // Establish Connection: A SYN from a new address takes a slot, and the first data pkt
+            // after our SYN-ACK opens the file, unless the SYN redeemed a ticket and brought data.
+            // With --syn-cookies the slot is taken only when that first data pkt brings the cookie back.
+
+            struct conn *c = connFind(conns, &cliaddr);
+            struct timeWait *tw = c == NULL ? timeWaitFind(tws, &cliaddr) : NULL;
+            if (tw != NULL && !recvpkt.syn)
+                timeWaitOnRecv(sockfd, tw, &recvpkt, &rext);
+            else if (c == NULL)
+            {
+                // A new connection from the address of one in TIME_WAIT ends the old one's teardown.
+                if (tw != NULL)
+                    tw->used = false;
+                // A stripe that joins a transfer under way writes into its file and takes no new number.
+                struct conn *opened = recvpkt.syn ? connOpen(sockfd, conns, &recvpkt, &rext, &rx, &cliaddr, cliaddrlen, seqNum, fileNo, &tickets, &cookies, groups) : NULL;
+                if (opened != NULL && opened->fileNo == fileNo)
+                    fileNo++;
+                else if (!recvpkt.syn && cookies.on && connFromCookie(sockfd, conns, &recvpkt, &rext, &rx, &cliaddr, cliaddrlen, fileNo, &cookies) != NULL)
+                    fileNo++;
+            }
+            else
+            {
+                connOnRecv(c, &rext, &rx);
+                if (c->state == CONN_SYN || (c->state == CONN_DATA && recvpkt.syn))
+                    connOnHandshake(sockfd, conns, c, &recvpkt);
+                else if (c->state == CONN_DATA)
+                {
+                    // Pkts queued by FEC are taken as if they had arrived along with the one that did.
+                    connOnData(sockfd, conns, c, &recvpkt, &rext, false, mode);
+                    while (c->state == CONN_DATA && c->fec.outI < c->fec.outN)
+                    {
+                        struct packet next = c->fec.out[c->fec.outI++];
+                        if (c->fec.outI == c->fec.outN)
+                            c->fec.outI = c->fec.outN = 0;
+                        connOnData(sockfd, conns, c, &next, &rext, true, mode);
+                    }
+                }
+                // =====================================
+                // Connection Teardown: Our FIN goes out once the client's is acked, and the rest of the
+                // teardown runs in the TIME_WAIT table. The next client's ISN carries on from here, as
+                // it did when clients were served in turn.
+                if (c->state == CONN_FIN)
+                {
+                    seqNum = (c->finpkt.seqnum + 1) % c->seqSpace % MAX_SEQN;
+                    timeWaitAdd(tws, c);
+                    connClose(c, showStats);
+                }
+            }
+        }
+
+        for (int j = 0; j < MAX_CONNS; j++)
+            connOnTimer(sockfd, &conns[j]);
+        for (int j = 0; j < TW_MAX; j++)
+            timeWaitOnTimer(sockfd, &tws[j]);
+        pullAllot(conns);
+        pullTell(sockfd, conns);
+    }
+}
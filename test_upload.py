@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+
+"""
+Checks of the uploads that build on what the server kept from an earlier one:
+each sends a file twice to one server over rdproxy.py and compares what the
+server wrote with what was sent.
+Usage: ./test_upload.py resume|dedup|delta [file_name] [drop_rate]
+Run it from the directory holding the server and client binaries.
+"""
+
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+BIN = os.getcwd()
+RESUME_AFTER = 50 # SEND lines the first --resume run gets to before it is killed
+
+
+class Upload:
+    """A server with --stats and an rdproxy.py in front of it, in a scratch directory."""
+
+    def __init__(self, drop_rate):
+        self.dir = tempfile.mkdtemp()
+        self.port = random.randint(20000, 40000)
+        self.procs = [
+            subprocess.Popen([BIN + '/server', '--stats', str(self.port)], cwd=self.dir,
+                             stdout=open(self.path('server1.txt'), 'w'), stderr=open(self.path('server.err'), 'w')),
+            subprocess.Popen(['python3', BIN + '/rdproxy.py', str(self.port), str(self.port + 1), str(drop_rate)],
+                             stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)]
+        time.sleep(0.5)
+
+    def path(self, name) -> str:
+        return os.path.join(self.dir, name)
+
+    def start(self, run, args, file_name) -> subprocess.Popen:
+        """Starts run number run of the client, its log line-buffered into client<run>.txt."""
+        return subprocess.Popen(['stdbuf', '-oL', BIN + '/client', '--stats'] + args +
+                                ['127.0.0.1', str(self.port + 1), file_name], cwd=self.dir,
+                                stdout=open(self.path('client%d.txt' % run), 'w'),
+                                stderr=open(self.path('client%d.err' % run), 'w'))
+
+    def run(self, run, args, file_name):
+        self.start(run, args, file_name).wait(timeout=120)
+        time.sleep(0.5)
+
+    def lines(self, name) -> list:
+        with open(self.path(name)) as f:
+            return f.readlines()
+
+    def stat(self, run, pattern) -> str:
+        """Returns the first group of pattern in the stats of run, None if it is not there."""
+        for line in self.lines('client%d.err' % run):
+            m = re.match(pattern, line)
+            if m:
+                return m.group(1)
+        return None
+
+    def same(self, file_name, name) -> bool:
+        return os.path.exists(self.path(name)) and subprocess.call(['cmp', '-s', file_name, self.path(name)]) == 0
+
+    def close(self, ok):
+        for p in self.procs:
+            p.kill()
+            p.wait()
+        if ok:
+            shutil.rmtree(self.dir)
+        else:
+            print('[Info] Logs in', self.dir)
+
+
+def check_resume(up, file_name) -> bool:
+    first = up.start(1, ['--resume'], file_name)
+    sends = 0
+    while first.poll() is None and sends < RESUME_AFTER:
+        time.sleep(0.01)
+        sends = sum(1 for line in up.lines('client1.txt') if line.startswith('SEND'))
+    if first.poll() is not None:
+        print('[Error] The first run was over before', RESUME_AFTER, 'SEND lines: the file is too small')
+        return False
+    first.kill()
+    first.wait()
+    up.run(2, ['--resume'], file_name)
+    resumed = up.stat(2, r'STATS resumed at (\d+) bytes')
+    files = [name for name in os.listdir(up.dir) if name.endswith('.file')]
+    print('[Info] Killed after', sends, 'SEND lines, resumed at', resumed, 'bytes')
+    return resumed is not None and int(resumed) > 0 and len(files) == 1 and up.same(file_name, files[0])
+
+
+def check_dedup(up, file_name) -> bool:
+    up.run(1, ['--dedup'], file_name)
+    up.run(2, ['--dedup'], file_name)
+    for run in (1, 2):
+        print('[Info] Run', run, 'sent', sum(1 for line in up.lines('client%d.txt' % run) if line.startswith('SEND')), 'pkts')
+    stored = up.stat(2, r'STATS dedup (server has the content)') is not None
+    return stored and up.same(file_name, '1.file') and up.same(file_name, '2.file')
+
+
+def check_delta(up, file_name) -> bool:
+    # Both versions go from the same path, which is what the server keeps the base under.
+    upload = up.path('upload')
+    with open(file_name, 'rb') as f:
+        data = f.read()
+    versions = [data, data[:len(data) // 2] + b'inserted by test_upload.py\n' + data[len(data) // 2:]]
+    for run, version in enumerate(versions, 1):
+        with open(upload, 'wb') as f:
+            f.write(version)
+        shutil.copy(upload, up.path('v%d' % run))
+        up.run(run, ['--delta'], upload)
+    copied = up.stat(2, r'STATS delta (\d+) blocks')
+    print('[Info] Blocks taken from the base the second time:', copied)
+    return copied is not None and int(copied) > 0 and up.same(up.path('v1'), '1.file') and up.same(up.path('v2'), '2.file')
+
+
+CHECKS = {'resume': check_resume, 'dedup': check_dedup, 'delta': check_delta}
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] not in CHECKS:
+        print("Usage:", sys.argv[0], '|'.join(CHECKS), "[file_name] [drop_rate]", file=sys.stderr)
+        exit(-1)
+    file_name = os.path.abspath(sys.argv[2] if len(sys.argv) > 2 else '100KB.txt')
+    up = Upload(float(sys.argv[3]) if len(sys.argv) > 3 else 0.1)
+    check_result = CHECKS[sys.argv[1]](up, file_name)
+    up.close(check_result)
+    print("Check result: ", check_result)
+    exit(0 if check_result else 1)